@@ -1,7 +1,20 @@
 #include <errno.h>
+#include <metal/time.h>
 #include <sys/time.h>
 
 int nanosleep(const struct timespec *rqtp, struct timespec *rmtp) {
-    errno = ENOSYS;
-    return -1;
+    if ((rqtp->tv_sec < 0) || (rqtp->tv_nsec < 0) ||
+        (rqtp->tv_nsec >= 1000000000)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (metal_delay(rqtp->tv_sec, rqtp->tv_nsec) != 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (rmtp) {
+        rmtp->tv_sec = 0;
+        rmtp->tv_nsec = 0;
+    }
+    return 0;
 }
@@ -3,6 +3,8 @@
 #include <errno.h>
 #include <metal/drivers/riscv_cpu.h>
 #include <metal/machine.h>
+#include <metal/time.h>
+#include <metal/timer.h>
 #include <time.h>
 
 #ifdef MTIME_RATE_HZ_DEF
@@ -14,16 +16,6 @@
 #define MTIME_RATE_HZ 32768
 #endif
 
-#if !defined(mtime_interrupt_controller) &&                                    \
-    defined(__METAL_DT_RISCV_CLINT0_HANDLE)
-#define mtime_interrupt_controller __METAL_DT_RISCV_CLINT0_HANDLE
-#endif
-
-#if !defined(mtime_interrupt_controller) &&                                    \
-    defined(__METAL_DT_SIFIVE_CLIC0_HANDLE)
-#define mtime_interrupt_controller __METAL_DT_SIFIVE_CLIC0_HANDLE
-#endif
-
 int clock_getres(clockid_t clk_id, struct timespec *res) {
     switch (clk_id) {
     case CLOCK_MONOTONIC:
@@ -37,15 +29,21 @@ int clock_getres(clockid_t clk_id, struct timespec *res) {
     }
 }
 
+/* On RV32 a 64-bit division by MTIME_RATE_HZ is still a libgcc call, even
+ * though it is a constant, so precompute the conversion instead */
+static struct metal_time_scale mtime_scale;
+
 int clock_gettime(clockid_t clk_id, struct timespec *tp) {
-    unsigned long long ticks;
+    unsigned long long ticks, frac;
 
     switch (clk_id) {
     case CLOCK_MONOTONIC:
-        mtime_interrupt_controller->vtable->command_request(
-            mtime_interrupt_controller, METAL_TIMER_MTIME_GET, &ticks);
-        tp->tv_sec = ticks / MTIME_RATE_HZ;
-        tp->tv_nsec = ((ticks % (MTIME_RATE_HZ)) * 1000000000) / MTIME_RATE_HZ;
+        ticks = metal_mtime_read();
+        if (mtime_scale.hz == 0) {
+            metal_time_scale_init(&mtime_scale, MTIME_RATE_HZ);
+        }
+        tp->tv_sec = metal_time_scale_split(&mtime_scale, ticks, &frac);
+        tp->tv_nsec = metal_time_scale_ns(&mtime_scale, frac);
         return 0;
         break;
     default:
@@ -1,20 +1,22 @@
 #include <errno.h>
+#include <metal/time.h>
 #include <metal/timer.h>
 #include <sys/time.h>
 
 int _gettimeofday(struct timeval *tp, void *tzp) {
     int rv;
-    unsigned long long mcc, timebase;
+    unsigned long long mcc, frac;
+    const struct metal_time_scale *scale;
     rv = metal_timer_get_cyclecount(0, &mcc);
     if (rv != 0) {
         return -1;
     }
-    rv = metal_timer_get_timebase_frequency(0, &timebase);
-    if (rv != 0) {
+    scale = metal_time_scale_timebase();
+    if (scale == NULL) {
         return -1;
     }
-    tp->tv_sec = mcc / timebase;
-    tp->tv_usec = mcc % timebase * 1000000 / timebase;
+    tp->tv_sec = metal_time_scale_split(scale, mcc, &frac);
+    tp->tv_usec = metal_time_scale_ns(scale, frac) / 1000;
     return 0;
 }
 
@@ -1,33 +1,10 @@
 #include <errno.h>
 #include <metal/cpu.h>
+#include <metal/time.h>
 #include <metal/timer.h>
 #include <sys/time.h>
 #include <sys/times.h>
 
-/* v * num / den while avoiding overflow
- *
- * Modulus on unsigned values is defined as:
- *
- *	v % den = v - (v / den) * den
- *	v = v % den + (v / den) * den
- *
- * This lets us break the computation down as follows:
- *
- *	r = (v * num) / den
- *	  = ((v % den + (v / den) * den) * num) / den
- *	  = ((v % den) * num) / den + ((v / den) * den) * num / den
- *	  = ((v % den) * num) / den + ((v / den) * num
- *
- * As long as num * den fits in 64 bits, then this computation will fit
- * in 64 bits. CLOCKS_PER_SEC is defined as 1,000,000, so we just need
- * timebase to be less than about 4,000,000,000,000 (4 trillion).
- */
-
-static inline unsigned long long
-muldiv(unsigned long long v, unsigned long long num, unsigned long long den) {
-    return (((v % den) * num) / den) + ((v / den) * num);
-}
-
 /* Timing information for current process. From
    newlib/libc/include/sys/times.h the tms struct fields are as follows:
 
@@ -41,22 +18,26 @@ muldiv(unsigned long long v, unsigned long long num, unsigned long long den) {
    account for user vs system time, but for now we just return the total
    number of cycles since starting the program.  */
 clock_t _times(struct tms *buf) {
-    unsigned long long mcc;
-    unsigned long long timebase;
+    unsigned long long mcc, frac;
+    const struct metal_time_scale *scale = metal_time_scale_timebase();
     int hartid = metal_cpu_get_current_hartid();
 
-    metal_timer_get_timebase_frequency(hartid, &timebase);
     metal_timer_get_cyclecount(hartid, &mcc);
 
     /*
-     * Convert from native resolution to published resolution.
+     * Convert from native resolution to published resolution, without
+     * dividing by the timebase.
      *
      * Truncating this to 64 bits works because a change of 'c' in
      * cyclecount will change the return value by
      * c * CLOCKS_PER_SEC / timebase, so applications will see
      * time marching forward.
      */
-    mcc = muldiv(mcc, CLOCKS_PER_SEC, timebase);
+    if (scale) {
+        mcc = metal_time_scale_split(scale, mcc, &frac) * CLOCKS_PER_SEC +
+              metal_time_scale_ns(scale, frac) /
+                  (1000000000 / CLOCKS_PER_SEC);
+    }
 
     buf->tms_stime = 0;
     buf->tms_cutime = 0;
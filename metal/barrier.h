@@ -0,0 +1,80 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef METAL__BARRIER_H
+#define METAL__BARRIER_H
+
+#include <metal/atomic.h>
+#include <metal/compiler.h>
+#include <metal/machine.h>
+
+/*!
+ * @file barrier.h
+ * @brief An API for synchronizing harts at runtime
+ */
+
+/*! @brief The number of times a hart polls the barrier before it sleeps */
+#ifndef METAL_HART_BARRIER_SPIN
+#define METAL_HART_BARRIER_SPIN 256
+#endif
+
+/*!
+ * @brief Declare a hart barrier
+ *
+ * Hart barriers must be initialized with metal_hart_barrier_init() before
+ * they are used.
+ */
+#define METAL_HART_BARRIER_DECLARE(name)                                       \
+    __attribute__((section(".data.locks"))) struct metal_hart_barrier name
+
+/*!
+ * @brief A handle for a hart barrier
+ *
+ * This is a sense-reversing barrier. Every hart which waits on it flips its
+ * own sense, and the last hart to arrive publishes the new sense, which
+ * releases the others and leaves the barrier ready for the next round.
+ */
+struct metal_hart_barrier {
+    metal_atomic_t _count;
+    volatile int _sense;
+    int _harts;
+    /* Written only by the hart it belongs to, apart from the wakeup */
+    struct {
+        int _sense;
+        volatile int _asleep;
+    } __attribute__((aligned(64))) _hart[__METAL_DT_MAX_HARTS];
+};
+
+/*!
+ * @brief Initialize a hart barrier
+ * @param barrier The handle for a barrier
+ * @param harts The number of harts which wait on the barrier in each round
+ * @return 0 if the barrier is successfully initialized. A non-zero code
+ * indicates failure.
+ *
+ * The barrier must be in memory which supports atomic operations.
+ */
+int metal_hart_barrier_init(struct metal_hart_barrier *barrier, int harts);
+
+/*!
+ * @brief Wait until all harts have reached a barrier
+ * @param barrier The handle for a barrier
+ * @return 1 on the hart which arrived last, 0 on the other harts, or -1 if
+ * the current hart cannot use the barrier
+ *
+ * A hart which has polled the barrier METAL_HART_BARRIER_SPIN times without
+ * being released waits for interrupts instead, and the last hart to arrive
+ * wakes it with a software interrupt. The software interrupt of the waiting
+ * hart is enabled in mie while it sleeps and is cleared before the barrier
+ * returns, and machine interrupts are disabled except to service other
+ * interrupts which wake the hart. Harts whose software interrupt controller
+ * is not initialized keep polling instead. Messages and remote calls sent
+ * to a sleeping hart with the hart mailboxes are delivered from the barrier
+ * each time the hart wakes.
+ *
+ * Memory accesses made by any hart before it reaches the barrier are
+ * visible to every hart after the barrier returns.
+ */
+int metal_hart_barrier_wait(struct metal_hart_barrier *barrier);
+
+#endif
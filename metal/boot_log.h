@@ -0,0 +1,108 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef METAL__BOOT_LOG_H
+#define METAL__BOOT_LOG_H
+
+/*! @file boot_log.h
+ * @brief API for the boot-time profiling timeline
+ *
+ * When freedom-metal is built with METAL_BOOT_LOG defined, the startup code
+ * timestamps the end of each boot phase with mcycle and records it in the
+ * boot log, which can be read or printed once main() is running. Each entry
+ * marks the end of a phase, so the time taken by a phase is the difference
+ * from the previous entry recorded by the same hart.
+ *
+ * The phases up to and including the zeroing of the BSS segment are only
+ * recorded for the boot hart, since the log itself lives in the BSS segment.
+ * mcycle is not synchronized between harts, so timestamps recorded by
+ * different harts can't be compared.
+ *
+ * Without METAL_BOOT_LOG the instrumentation is compiled out entirely and
+ * the log is always empty.
+ */
+
+/* The event IDs are shared with the startup code in assembly */
+#define METAL_BOOT_LOG_ENTER 0
+#define METAL_BOOT_LOG_SCRUB 1
+#define METAL_BOOT_LOG_DATA 2
+#define METAL_BOOT_LOG_ITIM 3
+#define METAL_BOOT_LOG_BSS 4
+#define METAL_BOOT_LOG_LIBC_INIT 5
+#define METAL_BOOT_LOG_CONSTRUCTOR 6
+#define METAL_BOOT_LOG_SYNC_HARTS 7
+#define METAL_BOOT_LOG_MAIN 8
+#define METAL_BOOT_LOG_USER 9
+
+#ifndef __ASSEMBLER__
+
+/*! @brief The number of entries the boot log holds. Entries recorded once
+ * the log is full are dropped. */
+#ifndef METAL_BOOT_LOG_ENTRIES
+#define METAL_BOOT_LOG_ENTRIES 64
+#endif
+
+/*! @brief An entry in the boot log
+ *
+ * The event is one of:
+ *  - METAL_BOOT_LOG_ENTER: _enter was reached
+ *  - METAL_BOOT_LOG_SCRUB: __metal_before_start, which scrubs memory,
+ *    returned
+ *  - METAL_BOOT_LOG_DATA: the data segment was copied
+ *  - METAL_BOOT_LOG_ITIM: the ITIM segment was copied
+ *  - METAL_BOOT_LOG_BSS: the BSS segment was zeroed
+ *  - METAL_BOOT_LOG_LIBC_INIT: the C library constructors returned
+ *  - METAL_BOOT_LOG_CONSTRUCTOR: the Metal constructor in arg returned
+ *  - METAL_BOOT_LOG_SYNC_HARTS: __metal_synchronize_harts() returned
+ *  - METAL_BOOT_LOG_MAIN: main() is about to be called
+ *  - METAL_BOOT_LOG_USER and above: recorded by the application
+ */
+struct metal_boot_log_entry {
+    /*! @brief The value of mcycle when the entry was recorded */
+    unsigned long long cycle;
+    /*! @brief The ID of the event */
+    int event;
+    /*! @brief The hart which recorded the entry */
+    int hartid;
+    /*! @brief Event specific data, such as the address of a constructor */
+    void *arg;
+};
+
+/*! @brief Record an entry in the boot log
+ * @param event The ID of the event, METAL_BOOT_LOG_USER or above for events
+ * defined by the application
+ * @param arg Event specific data
+ */
+void metal_boot_log_record(int event, void *arg);
+
+/*! @brief Get the number of entries in the boot log
+ * @return The number of entries, or 0 if the instrumentation is compiled out
+ */
+int metal_boot_log_count(void);
+
+/*! @brief Get an entry from the boot log
+ * @param index The index of the entry, in the order they were recorded
+ * @param entry Filled with the entry
+ * @return 0 on success, or -1 if there is no such entry
+ */
+int metal_boot_log_get(int index, struct metal_boot_log_entry *entry);
+
+/*! @brief Print the boot log
+ *
+ * Each line shows the hart, the event, the timestamp and the number of
+ * cycles since the previous entry of the same hart.
+ */
+void metal_boot_log_dump(void);
+
+/* Hook used by the startup code */
+#ifdef METAL_BOOT_LOG
+#define __METAL_BOOT_LOG(event, arg) metal_boot_log_record(event, arg)
+#else
+#define __METAL_BOOT_LOG(event, arg)                                           \
+    do {                                                                       \
+    } while (0)
+#endif
+
+#endif /* __ASSEMBLER__ */
+
+#endif
@@ -9,16 +9,48 @@
  *
  * @brief API for configuring caches
  */
+#include <stddef.h>
 #include <stdint.h>
 
 struct metal_cache;
 
+/*!
+ * @brief The geometry of a cache
+ */
+struct metal_cache_geometry {
+    /*! @brief The size of a cache line in bytes */
+    unsigned int line_size;
+    /*! @brief The number of sets, summed over all banks */
+    unsigned int sets;
+    /*! @brief The number of ways in each set */
+    unsigned int ways;
+    /*! @brief The total size of the cache in bytes */
+    size_t size;
+};
+
 struct __metal_cache_vtable {
     void (*init)(struct metal_cache *cache, int ways);
     int (*get_enabled_ways)(struct metal_cache *cache);
     int (*set_enabled_ways)(struct metal_cache *cache, int ways);
+    int (*get_geometry)(struct metal_cache *cache,
+                        struct metal_cache_geometry *geometry);
+    uint64_t (*get_way_mask)(struct metal_cache *cache, int master);
+    int (*set_way_mask)(struct metal_cache *cache, int master, uint64_t mask);
+    void (*flush_range)(struct metal_cache *cache, uintptr_t start,
+                        size_t len);
 };
 
+/* Shared by the L2 controller drivers, which have the same per-master
+ * WayMask registers and Flush64/Flush32 registers. way_mask is the address
+ * of WayMask0, and flush64 and flush32 the addresses of the flush
+ * registers. */
+uint64_t __metal_cache_l2_get_way_mask(uintptr_t way_mask, int master);
+int __metal_cache_l2_set_way_mask(uintptr_t way_mask, int master,
+                                  uint64_t mask, int ways);
+void __metal_cache_l2_flush_range(uintptr_t flush64, uintptr_t flush32,
+                                  unsigned int line_size, uintptr_t start,
+                                  size_t len);
+
 /*!
  * @brief a handle for a cache
  */
@@ -48,6 +80,10 @@ __inline__ int metal_cache_get_enabled_ways(struct metal_cache *cache) {
 
 /*!
  * @brief Enable the requested number of cache ways
+ *
+ * Ways can only be enabled. Once enabled, a way stays enabled until reset,
+ * so use metal_cache_set_way_mask() to keep masters out of some ways.
+ *
  * @param cache The handle for the cache
  * @param ways The number of ways to enabled
  * @return 0 if the ways are successfully enabled
@@ -57,6 +93,84 @@ __inline__ int metal_cache_set_enabled_ways(struct metal_cache *cache,
     return cache->vtable->set_enabled_ways(cache, ways);
 }
 
+/*!
+ * @brief Get the geometry of a cache
+ * @param cache The handle for the cache
+ * @param geometry Filled with the geometry of the cache
+ * @return 0 on success
+ */
+__inline__ int metal_cache_get_geometry(struct metal_cache *cache,
+                                        struct metal_cache_geometry *geometry) {
+    return cache->vtable->get_geometry(cache, geometry);
+}
+
+/*!
+ * @brief Get the ways a bus master may allocate into
+ * @param cache The handle for the cache
+ * @param master The index of the bus master, as listed in the manual of the
+ * SoC
+ * @return A mask with bit n set if the master may allocate into way n
+ */
+__inline__ uint64_t metal_cache_get_way_mask(struct metal_cache *cache,
+                                             int master) {
+    return cache->vtable->get_way_mask(cache, master);
+}
+
+/*!
+ * @brief Restrict the ways a bus master may allocate into
+ *
+ * Misses by the master only evict lines from the ways in the mask. Hits are
+ * not affected, so the master can still read lines held in other ways.
+ * Giving masters disjoint masks partitions the cache between them.
+ *
+ * @param cache The handle for the cache
+ * @param master The index of the bus master, as listed in the manual of the
+ * SoC
+ * @param mask A mask with bit n set if the master may allocate into way n
+ * @return 0 on success, or -1 if the master is out of range, or the mask is
+ * empty or names ways which are not enabled
+ */
+__inline__ int metal_cache_set_way_mask(struct metal_cache *cache, int master,
+                                        uint64_t mask) {
+    return cache->vtable->set_way_mask(cache, master, mask);
+}
+
+/*!
+ * @brief Write back and invalidate a range of addresses in a cache
+ * @param cache The handle for the cache
+ * @param start The physical address of the first byte to flush
+ * @param len The number of bytes to flush
+ */
+__inline__ void metal_cache_flush_range(struct metal_cache *cache,
+                                        uintptr_t start, size_t len) {
+    cache->vtable->flush_range(cache, start, len);
+}
+
+/*!
+ * @brief Pin a buffer into a set of locked ways
+ *
+ * The buffer is flushed from the L1 dcache of the current core and from the
+ * cache, then loaded into the locked ways through master. Finally the
+ * locked ways are removed from the way mask of master, so it can no longer
+ * evict the buffer.
+ *
+ * The buffer stays pinned only while no master may allocate into the locked
+ * ways, so the caller must also remove them from the way mask of every other
+ * master. The buffer must fit in the locked ways, that is at most
+ * (sets * line_size) bytes for each locked way, or part of it is evicted
+ * while it is loaded.
+ *
+ * @param cache The handle for the cache
+ * @param master The index of the bus master of the current core
+ * @param ways A mask of the ways to lock the buffer into
+ * @param start The address of the buffer
+ * @param len The size of the buffer in bytes
+ * @return 0 on success, or -1 if the ways cannot be locked, or if locking
+ * them would leave master with no ways to allocate into
+ */
+int metal_cache_lock_range(struct metal_cache *cache, int master,
+                           uint64_t ways, uintptr_t start, size_t len);
+
 /*!
  * @brief Check if dcache is supported on the core
  * @param hartid The core to check
@@ -64,6 +178,16 @@ __inline__ int metal_cache_set_enabled_ways(struct metal_cache *cache,
  */
 int metal_dcache_l1_available(int hartid);
 
+/*!
+ * @brief Get the geometry of the L1 dcache of a core
+ * @param hartid The core to query
+ * @param geometry Filled with the geometry of the dcache
+ * @return 0 on success, or -1 if the core has no dcache or the machine
+ * header doesn't describe its geometry
+ */
+int metal_dcache_l1_get_geometry(int hartid,
+                                 struct metal_cache_geometry *geometry);
+
 /*!
  * @brief Flush dcache for L1 on the requested core with write back
  * @param hartid  The core to flush
@@ -80,6 +204,34 @@ void metal_dcache_l1_flush(int hartid, uintptr_t address);
  */
 void metal_dcache_l1_discard(int hartid, uintptr_t address);
 
+/*!
+ * @brief Flush a range of addresses from the L1 dcache of the current core
+ * with write back
+ *
+ * Every line overlapping the range is written back and invalidated. Ranges
+ * larger than the cache flush the whole cache instead.
+ *
+ * @param start The virtual address of the first byte to flush
+ * @param len The number of bytes to flush
+ * @return None
+ */
+void metal_dcache_l1_flush_range(uintptr_t start, size_t len);
+
+/*!
+ * @brief Discard a range of addresses from the L1 dcache of the current core
+ * with no write back
+ *
+ * Every line overlapping the range is invalidated, including the parts of
+ * the first and last lines outside of the range. Unlike
+ * metal_dcache_l1_flush_range(), large ranges are still discarded line by
+ * line, since discarding the whole cache would lose unrelated writes.
+ *
+ * @param start The virtual address of the first byte to discard
+ * @param len The number of bytes to discard
+ * @return None
+ */
+void metal_dcache_l1_discard_range(uintptr_t start, size_t len);
+
 /*!
  * @brief Check if icache is supported on the core
  * @param hartid The core to check
@@ -87,4 +239,14 @@ void metal_dcache_l1_discard(int hartid, uintptr_t address);
  */
 int metal_icache_l1_available(int hartid);
 
+/*!
+ * @brief Get the geometry of the L1 icache of a core
+ * @param hartid The core to query
+ * @param geometry Filled with the geometry of the icache
+ * @return 0 on success, or -1 if the core has no icache or the machine
+ * header doesn't describe its geometry
+ */
+int metal_icache_l1_get_geometry(int hartid,
+                                 struct metal_cache_geometry *geometry);
+
 #endif
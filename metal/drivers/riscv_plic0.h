@@ -6,6 +6,7 @@
 
 #include <metal/compiler.h>
 #include <metal/drivers/riscv_cpu.h>
+#include <metal/io.h>
 
 #define METAL_PLIC_SOURCE_MASK 0x1F
 #define METAL_PLIC_SOURCE_SHIFT 5
@@ -18,13 +19,22 @@ struct __metal_driver_vtable_riscv_plic0 {
 
 __METAL_DECLARE_VTABLE(__metal_driver_vtable_riscv_plic0)
 
+/* A registered handler and its data, kept side by side so that dispatching
+ * an interrupt touches a single table entry */
+struct __metal_plic0_dispatch {
+    metal_interrupt_handler_t handler;
+    void *exint_data;
+};
+
 #define __METAL_MACHINE_MACROS
 #include <metal/machine.h>
 struct __metal_driver_riscv_plic0 {
     struct metal_interrupt controller;
     int init_done;
-    metal_interrupt_handler_t metal_exint_table[__METAL_PLIC_SUBINTERRUPTS];
-    __metal_interrupt_data metal_exdata_table[__METAL_PLIC_SUBINTERRUPTS];
+    struct __metal_plic0_dispatch metal_exint_table[__METAL_PLIC_SUBINTERRUPTS];
+    /* The claim/complete register of the context each hart takes its
+     * external interrupts on, indexed by hart ID */
+    __metal_io_u32 *claim_table[__METAL_DT_MAX_HARTS];
 };
 #undef __METAL_MACHINE_MACROS
 
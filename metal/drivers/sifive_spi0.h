@@ -16,11 +16,45 @@ struct __metal_driver_vtable_sifive_spi0 {
 
 __METAL_DECLARE_VTABLE(__metal_driver_vtable_sifive_spi0)
 
+/* metal_spi_transfer_async() is only supported when the machine header
+ * defines __METAL_SIFIVE_SPI0_INTERRUPTS along with the
+ * __metal_driver_sifive_spi0_interrupt_parent() and
+ * __metal_driver_sifive_spi0_interrupt_line() accessors. Otherwise it
+ * fails. */
+#ifndef __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH
+#define __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH 4
+#endif
+
+struct __metal_driver_sifive_spi0_transaction {
+    struct metal_spi_config *config;
+    size_t len;
+    char *tx_buf;
+    char *rx_buf;
+    metal_spi_callback_t callback;
+    void *priv;
+};
+
 struct __metal_driver_sifive_spi0 {
     struct metal_spi spi;
     unsigned long baud_rate;
     metal_clock_callback pre_rate_change_callback;
     metal_clock_callback post_rate_change_callback;
+
+    /* Set while a transfer has taken the flash interface out of
+     * memory-mapped mode, which is restored once the transfer ends */
+    int flash_restore;
+
+    /* Pending asynchronous transfers. head and tail are free-running, and the
+     * transaction at head is on the bus while async_active is set. */
+    struct __metal_driver_sifive_spi0_transaction
+        async_queue[__METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH];
+    volatile unsigned int async_head;
+    volatile unsigned int async_tail;
+    volatile int async_active;
+    int async_phase;
+    size_t async_tx_i;
+    size_t async_rx_i;
+    int async_irq_registered;
 };
 
 #endif
@@ -19,11 +19,24 @@ struct __metal_driver_sifive_uart0;
 
 __METAL_DECLARE_VTABLE(__metal_driver_vtable_sifive_uart0)
 
+/* Single-producer, single-consumer ring buffer shared between the UART
+ * interrupt handler and the rest of the program. head and tail are
+ * free-running counters, and the buffer length is a power of two. */
+struct __metal_driver_sifive_uart0_ring {
+    char *buf;
+    size_t mask;
+    volatile size_t head;
+    volatile size_t tail;
+};
+
 struct __metal_driver_sifive_uart0 {
     struct metal_uart uart;
     unsigned long baud_rate;
     metal_clock_callback pre_rate_change_callback;
     metal_clock_callback post_rate_change_callback;
+    struct __metal_driver_sifive_uart0_ring tx_ring;
+    struct __metal_driver_sifive_uart0_ring rx_ring;
+    struct metal_uart_stats stats;
 };
 
 #endif
@@ -23,6 +23,8 @@ void __metal_driver_ucb_htif0_exit(const struct __metal_shutdown *test,
 
 void __metal_driver_ucb_htif0_init(struct metal_uart *uart, int baud_rate);
 int __metal_driver_ucb_htif0_putc(struct metal_uart *uart, int c);
+int __metal_driver_ucb_htif0_write_buf(struct metal_uart *uart,
+                                       const char *buf, size_t len);
 int __metal_driver_ucb_htif0_getc(struct metal_uart *uart, int *c);
 int __metal_driver_ucb_htif0_get_baud_rate(struct metal_uart *guart);
 int __metal_driver_ucb_htif0_set_baud_rate(struct metal_uart *guart,
@@ -52,6 +52,61 @@ typedef void (*metal_destructor_t)(void);
         metal_constructor_t _##function_name##_ptr = &function_name;           \
     void function_name(void)
 
+/*! @def METAL_CONSTRUCTOR_PARALLEL
+ * @brief Define a Metal constructor which may run in parallel with others
+ *
+ * Parallel constructors are called by metal_init() once all the constructors
+ * defined with METAL_CONSTRUCTOR() and METAL_CONSTRUCTOR_PRIO() have
+ * returned, in no particular order. They must not depend on each other.
+ *
+ * When freedom-metal is built with METAL_INIT_PARALLEL defined, secondary
+ * harts wait in crt0 until the boot hart reaches the parallel constructors,
+ * and then take constructors from the list alongside it. Otherwise the boot
+ * hart calls them all itself. The secondary harts wait for as long as it
+ * takes, so an application which redefines metal_init_run() must still call
+ * metal_init() on the boot hart, or they never reach secondary_main().
+ */
+#define METAL_CONSTRUCTOR_PARALLEL(function_name)                              \
+    __attribute__((section(".metal.ctors"))) void function_name(void);         \
+    __attribute__((section("metal_init_parallel"), used))                      \
+    const metal_constructor_t _##function_name##_parallel_ptr =                \
+        &function_name;                                                        \
+    void function_name(void)
+
+/*!
+ * @brief The state of a constructor which runs on first use
+ */
+struct metal_init_once {
+    metal_constructor_t function;
+    volatile int state;
+};
+
+/*! @def METAL_CONSTRUCTOR_LAZY
+ * @brief Define a Metal constructor which runs on first use
+ *
+ * Lazy constructors are not called by metal_init(). Instead, the code which
+ * needs the initialization done calls METAL_INIT_ONCE() with the name of the
+ * constructor before using the device, which keeps the work out of the path
+ * from reset to main.
+ */
+#define METAL_CONSTRUCTOR_LAZY(function_name)                                  \
+    void function_name(void);                                                  \
+    struct metal_init_once function_name##_once = {function_name, 0};          \
+    void function_name(void)
+
+/*! @def METAL_CONSTRUCTOR_LAZY_DECLARE
+ * @brief Declare a lazy constructor defined in another file
+ */
+#define METAL_CONSTRUCTOR_LAZY_DECLARE(function_name)                          \
+    extern struct metal_init_once function_name##_once
+
+/*! @def METAL_INIT_ONCE
+ * @brief Run a lazy constructor unless it has already run
+ *
+ * If another hart is running the constructor, this waits until it returns.
+ */
+#define METAL_INIT_ONCE(function_name) metal_init_once(&function_name##_once)
+
 /*! @def METAL_DESTRUCTOR
  * @brief Define a Metal destructor
  *
@@ -89,12 +144,20 @@ typedef void (*metal_destructor_t)(void);
  * and calls them in turn.
  *
  * You can add your own constructors to the functions called by metal_init()
- * by defining functions with the METAL_CONSTRUCTOR() macro.
+ * by defining functions with the METAL_CONSTRUCTOR() macro. Constructors
+ * defined with METAL_CONSTRUCTOR_PARALLEL() are called last.
  *
  * This function is called before main by default by metal_init_run().
  */
 void metal_init(void);
 
+/*!
+ * @brief Call a lazy constructor unless it has already been called
+ * @param once The state of the constructor, defined by
+ * METAL_CONSTRUCTOR_LAZY()
+ */
+void metal_init_once(struct metal_init_once *once);
+
 /*!
  * @brief Call all Metal destructors
  *
@@ -115,6 +178,10 @@ void metal_fini(void);
  * This function calls metal_init() before main by default. If you wish to
  * replace or augment this call to the Metal constructors, you can redefine
  * metal_init_run()
+ *
+ * When freedom-metal is built with METAL_INIT_PARALLEL and the application
+ * has parallel constructors, a redefinition must call metal_init(), since
+ * the secondary harts wait in crt0 until the boot hart reaches them.
  */
 void metal_init_run(void);
 
@@ -0,0 +1,117 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef METAL__IRQ_STATS_H
+#define METAL__IRQ_STATS_H
+
+/*! @file irq_stats.h
+ * @brief API for interrupt latency statistics
+ *
+ * When freedom-metal is built with METAL_IRQ_STATS defined, the interrupt
+ * dispatch paths timestamp each interrupt with mcycle at trap entry, before
+ * calling the registered handler, and after it returns. The results are
+ * accumulated per hart and per interrupt ID.
+ *
+ * Without METAL_IRQ_STATS the instrumentation is compiled out entirely, and
+ * metal_irq_stats_get() returns -1.
+ */
+
+/*! @brief The number of buckets in the latency histogram */
+#define METAL_IRQ_STATS_BUCKETS 8
+
+/*! @brief Latencies below 2^METAL_IRQ_STATS_BUCKET_SHIFT cycles are counted
+ * in the first histogram bucket */
+#define METAL_IRQ_STATS_BUCKET_SHIFT 5
+
+/*! @brief The interrupt controller an interrupt ID belongs to */
+enum metal_irq_stats_source {
+    /*! @brief Interrupts dispatched by the CPU, indexed by mcause */
+    METAL_IRQ_STATS_CPU,
+    /*! @brief Global interrupts dispatched by the PLIC */
+    METAL_IRQ_STATS_PLIC,
+    /*! @brief Interrupts dispatched by the CLIC */
+    METAL_IRQ_STATS_CLIC,
+};
+
+/*! @brief Statistics for one interrupt ID on one hart
+ *
+ * All times are in mcycle ticks. Latency runs from trap entry until the
+ * registered handler is called, and run time covers the handler alone.
+ */
+struct metal_irq_stats {
+    /*! @brief The number of times the handler was called */
+    unsigned long count;
+    /*! @brief The shortest latency seen */
+    unsigned long latency_min;
+    /*! @brief The longest latency seen */
+    unsigned long latency_max;
+    /*! @brief The sum of all latencies, for computing the mean */
+    unsigned long long latency_total;
+    /*! @brief The shortest handler run time seen */
+    unsigned long run_min;
+    /*! @brief The longest handler run time seen */
+    unsigned long run_max;
+    /*! @brief The sum of all handler run times, for computing the mean */
+    unsigned long long run_total;
+    /*! @brief Latency histogram. Bucket n counts latencies below
+     * 2^(n + METAL_IRQ_STATS_BUCKET_SHIFT) cycles which are not counted in
+     * an earlier bucket, and the last bucket counts everything longer. */
+    unsigned long latency_hist[METAL_IRQ_STATS_BUCKETS];
+};
+
+/*! @brief Get the statistics of an interrupt
+ *
+ * The statistics are updated by the hart taking the interrupt without any
+ * locking, so reading those of another hart while it takes the interrupt may
+ * return a torn snapshot.
+ *
+ * @param hartid The hart which took the interrupt
+ * @param source The interrupt controller which dispatched the interrupt
+ * @param id The interrupt ID
+ * @param stats Filled with the statistics
+ * @return 0 on success, or -1 if the arguments are out of range or the
+ * instrumentation is compiled out
+ */
+int metal_irq_stats_get(int hartid, enum metal_irq_stats_source source, int id,
+                        struct metal_irq_stats *stats);
+
+/*! @brief Clear the statistics of every interrupt on every hart */
+void metal_irq_stats_reset(void);
+
+/*! @brief Print the statistics of every interrupt which has been taken
+ *
+ * Each line shows the hart, controller and ID followed by the count and the
+ * minimum, mean and maximum latency and run time, in cycles.
+ */
+void metal_irq_stats_dump(void);
+
+/* Hooks used by the interrupt dispatch paths */
+#ifdef METAL_IRQ_STATS
+#include <metal/time.h>
+
+void __metal_irq_stats_enter(unsigned long long now);
+void __metal_irq_stats_record(enum metal_irq_stats_source source, int id,
+                              unsigned long long start,
+                              unsigned long long end);
+
+/* Timestamp trap entry on the current hart */
+#define __METAL_IRQ_STATS_ENTER() __metal_irq_stats_enter(metal_deadline_now())
+
+/* Run call, the registered handler of interrupt id, and record it */
+#define __METAL_IRQ_STATS_DISPATCH(source, id, call)                           \
+    do {                                                                       \
+        unsigned long long __start = metal_deadline_now();                     \
+        call;                                                                  \
+        __metal_irq_stats_record(source, id, __start, metal_deadline_now());   \
+    } while (0)
+#else
+#define __METAL_IRQ_STATS_ENTER()                                              \
+    do {                                                                       \
+    } while (0)
+#define __METAL_IRQ_STATS_DISPATCH(source, id, call)                           \
+    do {                                                                       \
+        call;                                                                  \
+    } while (0)
+#endif
+
+#endif
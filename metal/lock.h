@@ -4,6 +4,7 @@
 #ifndef METAL__LOCK_H
 #define METAL__LOCK_H
 
+#include <metal/atomic.h>
 #include <metal/compiler.h>
 #include <metal/machine.h>
 #include <metal/memory.h>
@@ -19,6 +20,16 @@
 #define METAL_LOCK_BACKOFF_CYCLES 32
 #define METAL_LOCK_BACKOFF_EXPONENT 2
 
+/* Spin locations are padded to this size so that no two harts spin on the
+ * same cache line */
+#define METAL_LOCK_CACHE_LINE 64
+
+#if __riscv_xlen == 32
+#define _METAL_LOCK_AMO_PTR "w"
+#else
+#define _METAL_LOCK_AMO_PTR "d"
+#endif
+
 /*!
  * @def METAL_LOCK_DECLARE
  * @brief Declare a lock
@@ -115,6 +126,53 @@ __inline__ int metal_lock_take(struct metal_lock *lock) {
 #endif
 }
 
+/*!
+ * @brief Take a lock if it is free
+ * @param lock The handle for a lock
+ * @return 0 if the lock is successfully taken, or 1 if it is held
+ *
+ * If the lock initialization failed, attempts to take a lock will result in
+ * a Store/AMO access fault.
+ */
+__inline__ int metal_lock_try_take(struct metal_lock *lock) {
+#ifdef __riscv_atomic
+    int old = 1;
+    int new = 1;
+
+    /* Leave the cache line shared while the lock is held */
+    if (*(volatile int *)&(lock->_state) != 0) {
+        return 1;
+    }
+
+    __asm__ volatile("amoswap.w.aq %[old], %[new], (%[state])"
+                     : [old] "=r"(old)
+                     : [new] "r"(new), [state] "r"(&(lock->_state))
+                     : "memory");
+
+    return (old != 0);
+#else
+    /* Store the memory address in mtval like a normal store/amo access fault */
+    __asm__("csrw mtval, %[state]" ::[state] "r"(&(lock->_state)));
+
+    /* Trigger a Store/AMO access fault */
+    _metal_trap(_METAL_STORE_AMO_ACCESS_FAULT);
+
+    /* If execution returns, indicate failure */
+    return 1;
+#endif
+}
+
+/*!
+ * @brief Take a lock, giving up after a timeout
+ * @param lock The handle for a lock
+ * @param timeout_us The number of microseconds to wait for the lock
+ * @return 0 if the lock is successfully taken, or -1 if the timeout expired
+ *
+ * If the lock initialization failed, attempts to take a lock will result in
+ * a Store/AMO access fault.
+ */
+int metal_lock_take_timeout(struct metal_lock *lock, unsigned long timeout_us);
+
 /*!
  * @brief Give back a held lock
  * @param lock The handle for a lock
@@ -142,4 +200,471 @@ __inline__ int metal_lock_give(struct metal_lock *lock) {
 #endif
 }
 
+/*!
+ * @def METAL_TICKET_LOCK_DECLARE
+ * @brief Declare a ticket lock
+ *
+ * Like METAL_LOCK_DECLARE, this links the lock into a memory region which
+ * supports atomic memory operations.
+ */
+#define METAL_TICKET_LOCK_DECLARE(name)                                        \
+    __attribute__((section(".data.locks"))) struct metal_ticket_lock name
+
+/*!
+ * @brief A handle for a ticket lock
+ *
+ * A ticket lock hands itself out in the order harts ask for it, so no hart
+ * can be starved. Each waiting hart spins on its own cache line, which the
+ * previous holder writes once when it gives the lock back.
+ */
+struct metal_ticket_lock {
+    unsigned int _next;
+    unsigned int _owner;
+    struct {
+        volatile unsigned int _ticket;
+    } __attribute__((aligned(METAL_LOCK_CACHE_LINE)))
+    _grant[__METAL_DT_MAX_HARTS];
+};
+
+/*!
+ * @brief Initialize a ticket lock
+ * @param lock The handle for a ticket lock
+ * @return 0 if the lock is successfully initialized. A non-zero code indicates
+ * failure.
+ */
+__inline__ int metal_ticket_lock_init(struct metal_ticket_lock *lock) {
+#ifdef __riscv_atomic
+    struct metal_memory *lock_mem =
+        metal_get_memory_from_address((uintptr_t) & (lock->_next));
+    if (!lock_mem) {
+        return 1;
+    }
+    if (!metal_memory_supports_atomics(lock_mem)) {
+        return 2;
+    }
+
+    lock->_next = 0;
+    lock->_owner = 0;
+    /* Ticket 0 is granted, and no other slot matches its first ticket */
+    for (int i = 0; i < __METAL_DT_MAX_HARTS; i++) {
+        lock->_grant[i]._ticket = (i == 0) ? 0 : -1;
+    }
+
+    return 0;
+#else
+    return 3;
+#endif
+}
+
+/*!
+ * @brief Take a ticket lock, waiting behind the harts which asked first
+ * @param lock The handle for a ticket lock
+ * @return 0 if the lock is successfully taken
+ */
+__inline__ int metal_ticket_lock_take(struct metal_ticket_lock *lock) {
+#ifdef __riscv_atomic
+    unsigned int ticket;
+
+    __asm__ volatile("amoadd.w %[ticket], %[one], (%[next])"
+                     : [ticket] "=r"(ticket)
+                     : [one] "r"(1), [next] "r"(&(lock->_next))
+                     : "memory");
+
+    while (lock->_grant[ticket % __METAL_DT_MAX_HARTS]._ticket != ticket)
+        ;
+    __asm__ volatile("fence r, rw" ::: "memory");
+
+    lock->_owner = ticket;
+
+    return 0;
+#else
+    __asm__("csrw mtval, %[next]" ::[next] "r"(&(lock->_next)));
+    _metal_trap(_METAL_STORE_AMO_ACCESS_FAULT);
+    return 1;
+#endif
+}
+
+/*!
+ * @brief Give back a held ticket lock to the next hart in line
+ * @param lock The handle for a ticket lock
+ * @return 0 if the lock is successfully given
+ */
+__inline__ int metal_ticket_lock_give(struct metal_ticket_lock *lock) {
+    unsigned int next = lock->_owner + 1;
+
+    __asm__ volatile("fence rw, w" ::: "memory");
+    lock->_grant[next % __METAL_DT_MAX_HARTS]._ticket = next;
+
+    return 0;
+}
+
+/*!
+ * @def METAL_MCS_LOCK_DECLARE
+ * @brief Declare an MCS queue lock
+ *
+ * Like METAL_LOCK_DECLARE, this links the lock into a memory region which
+ * supports atomic memory operations.
+ */
+#define METAL_MCS_LOCK_DECLARE(name)                                           \
+    __attribute__((section(".data.locks"))) struct metal_mcs_lock name
+
+/*!
+ * @brief A waiter in the queue of an MCS lock
+ */
+struct metal_mcs_node {
+    struct metal_mcs_node *volatile _next;
+    volatile int _locked;
+} __attribute__((aligned(METAL_LOCK_CACHE_LINE)));
+
+/*!
+ * @brief A handle for an MCS queue lock
+ *
+ * Harts waiting for an MCS lock queue up behind each other, each spinning on
+ * its own node until the hart ahead of it hands the lock over. Taking and
+ * giving the lock costs one atomic operation on the shared tail pointer no
+ * matter how many harts are waiting. Each hart has one node per lock, so a
+ * hart must not take the same lock twice.
+ */
+struct metal_mcs_lock {
+    struct metal_mcs_node *volatile _tail;
+    struct metal_mcs_node _node[__METAL_DT_MAX_HARTS];
+};
+
+/*!
+ * @brief Initialize an MCS lock
+ * @param lock The handle for an MCS lock
+ * @return 0 if the lock is successfully initialized. A non-zero code indicates
+ * failure.
+ */
+__inline__ int metal_mcs_lock_init(struct metal_mcs_lock *lock) {
+#ifdef __riscv_atomic
+    struct metal_memory *lock_mem =
+        metal_get_memory_from_address((uintptr_t) & (lock->_tail));
+    if (!lock_mem) {
+        return 1;
+    }
+    if (!metal_memory_supports_atomics(lock_mem)) {
+        return 2;
+    }
+
+    lock->_tail = NULL;
+
+    return 0;
+#else
+    return 3;
+#endif
+}
+
+/*!
+ * @brief Take an MCS lock, waiting behind the harts which asked first
+ * @param lock The handle for an MCS lock
+ * @return 0 if the lock is successfully taken
+ */
+__inline__ int metal_mcs_lock_take(struct metal_mcs_lock *lock) {
+#ifdef __riscv_atomic
+    uintptr_t hartid;
+    struct metal_mcs_node *node, *prev;
+
+    __asm__ volatile("csrr %0, mhartid" : "=r"(hartid));
+    node = &lock->_node[hartid];
+    node->_next = NULL;
+    node->_locked = 1;
+
+    /* Join the queue, publishing the node initialization with it */
+    __asm__ volatile("amoswap." _METAL_LOCK_AMO_PTR ".aqrl %[prev], %[node], "
+                     "(%[tail])"
+                     : [prev] "=r"(prev)
+                     : [node] "r"(node), [tail] "r"(&(lock->_tail))
+                     : "memory");
+
+    if (prev != NULL) {
+        prev->_next = node;
+        while (node->_locked)
+            ;
+        __asm__ volatile("fence r, rw" ::: "memory");
+    }
+
+    return 0;
+#else
+    __asm__("csrw mtval, %[tail]" ::[tail] "r"(&(lock->_tail)));
+    _metal_trap(_METAL_STORE_AMO_ACCESS_FAULT);
+    return 1;
+#endif
+}
+
+/*!
+ * @brief Give back a held MCS lock to the next hart in line
+ * @param lock The handle for an MCS lock
+ * @return 0 if the lock is successfully given
+ */
+__inline__ int metal_mcs_lock_give(struct metal_mcs_lock *lock) {
+#ifdef __riscv_atomic
+    uintptr_t hartid;
+    struct metal_mcs_node *node, *tail;
+    int fail;
+
+    __asm__ volatile("csrr %0, mhartid" : "=r"(hartid));
+    node = &lock->_node[hartid];
+
+    if (node->_next == NULL) {
+        /* Nobody is known to be waiting, so try to empty the queue */
+        __asm__ volatile("1: lr." _METAL_LOCK_AMO_PTR ".aq %[tail], (%[lock])\n"
+                         "   bne %[tail], %[node], 2f\n"
+                         "   sc." _METAL_LOCK_AMO_PTR ".rl %[fail], zero, "
+                         "(%[lock])\n"
+                         "   bnez %[fail], 1b\n"
+                         "2:"
+                         : [tail] "=&r"(tail), [fail] "=&r"(fail)
+                         : [lock] "r"(&(lock->_tail)), [node] "r"(node)
+                         : "memory");
+        if (tail == node) {
+            return 0;
+        }
+
+        /* A hart has joined the queue but not yet linked itself in */
+        while (node->_next == NULL)
+            ;
+    }
+
+    __asm__ volatile("fence rw, w" ::: "memory");
+    node->_next->_locked = 0;
+
+    return 0;
+#else
+    __asm__("csrw mtval, %[tail]" ::[tail] "r"(&(lock->_tail)));
+    _metal_trap(_METAL_STORE_AMO_ACCESS_FAULT);
+    return 1;
+#endif
+}
+
+/*!
+ * @def METAL_RWLOCK_DECLARE
+ * @brief Declare a reader-writer lock
+ *
+ * Like METAL_LOCK_DECLARE, this links the lock into a memory region which
+ * supports atomic memory operations.
+ */
+#define METAL_RWLOCK_DECLARE(name)                                             \
+    __attribute__((section(".data.locks"))) struct metal_rwlock name
+
+/* Set in metal_rwlock._state while a writer holds or waits for the lock. The
+ * remaining bits count the readers holding it. */
+#define _METAL_RWLOCK_WRITER (1 << 30)
+
+/*!
+ * @brief A handle for a reader-writer lock
+ *
+ * Any number of readers can hold a reader-writer lock at once, while a writer
+ * holds it alone. A waiting writer keeps new readers out, so readers can't
+ * starve it.
+ */
+struct metal_rwlock {
+    metal_atomic_t _state;
+};
+
+/*!
+ * @brief Initialize a reader-writer lock
+ * @param lock The handle for a reader-writer lock
+ * @return 0 if the lock is successfully initialized. A non-zero code indicates
+ * failure.
+ */
+__inline__ int metal_rwlock_init(struct metal_rwlock *lock) {
+#ifdef __riscv_atomic
+    struct metal_memory *lock_mem =
+        metal_get_memory_from_address((uintptr_t) & (lock->_state));
+    if (!lock_mem) {
+        return 1;
+    }
+    if (!metal_memory_supports_atomics(lock_mem)) {
+        return 2;
+    }
+
+    lock->_state = 0;
+
+    return 0;
+#else
+    return 3;
+#endif
+}
+
+/*!
+ * @brief Take a reader-writer lock for reading
+ * @param lock The handle for a reader-writer lock
+ * @return 0 if the lock is successfully taken
+ */
+__inline__ int metal_rwlock_read_take(struct metal_rwlock *lock) {
+    while (1) {
+        while (lock->_state & _METAL_RWLOCK_WRITER)
+            ;
+        if (!(metal_atomic_add(&(lock->_state), 1) & _METAL_RWLOCK_WRITER)) {
+            break;
+        }
+        /* A writer got in first, back out until it is done */
+        metal_atomic_add(&(lock->_state), -1);
+    }
+    __asm__ volatile("fence r, rw" ::: "memory");
+
+    return 0;
+}
+
+/*!
+ * @brief Give back a reader-writer lock held for reading
+ * @param lock The handle for a reader-writer lock
+ * @return 0 if the lock is successfully given
+ */
+__inline__ int metal_rwlock_read_give(struct metal_rwlock *lock) {
+    __asm__ volatile("fence rw, w" ::: "memory");
+    metal_atomic_add(&(lock->_state), -1);
+
+    return 0;
+}
+
+/*!
+ * @brief Take a reader-writer lock for writing
+ * @param lock The handle for a reader-writer lock
+ * @return 0 if the lock is successfully taken
+ */
+__inline__ int metal_rwlock_write_take(struct metal_rwlock *lock) {
+    /* Claim the writer bit, then wait for the readers to leave */
+    while (metal_atomic_or(&(lock->_state), _METAL_RWLOCK_WRITER) &
+           _METAL_RWLOCK_WRITER) {
+        while (lock->_state & _METAL_RWLOCK_WRITER)
+            ;
+    }
+    while (lock->_state & ~_METAL_RWLOCK_WRITER)
+        ;
+    __asm__ volatile("fence r, rw" ::: "memory");
+
+    return 0;
+}
+
+/*!
+ * @brief Give back a reader-writer lock held for writing
+ * @param lock The handle for a reader-writer lock
+ * @return 0 if the lock is successfully given
+ */
+__inline__ int metal_rwlock_write_give(struct metal_rwlock *lock) {
+    __asm__ volatile("fence rw, w" ::: "memory");
+    metal_atomic_and(&(lock->_state), ~_METAL_RWLOCK_WRITER);
+
+    return 0;
+}
+
+/*!
+ * @def METAL_SEQLOCK_DECLARE
+ * @brief Declare a sequence lock
+ *
+ * Like METAL_LOCK_DECLARE, this links the lock into a memory region which
+ * supports atomic memory operations.
+ */
+#define METAL_SEQLOCK_DECLARE(name)                                            \
+    __attribute__((section(".data.locks"))) struct metal_seqlock name
+
+/*!
+ * @brief A handle for a sequence lock
+ *
+ * A sequence lock protects data which is read far more often than it is
+ * written. Writers serialize against each other, but readers take no lock and
+ * use no atomic operations. Instead, a reader retries if a writer changed the
+ * data while it was reading:
+ *
+ * @code
+ * unsigned int seq;
+ * do {
+ *     seq = metal_seqlock_read_begin(&lock);
+ *     copy = shared;
+ * } while (metal_seqlock_read_retry(&lock, seq));
+ * @endcode
+ *
+ * Readers may observe a partial update before retrying, so they must only
+ * copy the data out and not follow pointers in it.
+ */
+struct metal_seqlock {
+    metal_atomic_t _seq;
+};
+
+/*!
+ * @brief Initialize a sequence lock
+ * @param lock The handle for a sequence lock
+ * @return 0 if the lock is successfully initialized. A non-zero code indicates
+ * failure.
+ */
+__inline__ int metal_seqlock_init(struct metal_seqlock *lock) {
+#ifdef __riscv_atomic
+    struct metal_memory *lock_mem =
+        metal_get_memory_from_address((uintptr_t) & (lock->_seq));
+    if (!lock_mem) {
+        return 1;
+    }
+    if (!metal_memory_supports_atomics(lock_mem)) {
+        return 2;
+    }
+
+    lock->_seq = 0;
+
+    return 0;
+#else
+    return 3;
+#endif
+}
+
+/*!
+ * @brief Start updating the data protected by a sequence lock
+ * @param lock The handle for a sequence lock
+ * @return 0 once no other writer holds the lock
+ */
+__inline__ int metal_seqlock_write_begin(struct metal_seqlock *lock) {
+    /* An odd sequence number marks an update in progress */
+    while (metal_atomic_or(&(lock->_seq), 1) & 1) {
+        while (lock->_seq & 1)
+            ;
+    }
+    /* Keep both the loads and the stores of the update after the odd
+     * sequence number, as metal_lock_take() does */
+    __asm__ volatile("fence rw, rw" ::: "memory");
+
+    return 0;
+}
+
+/*!
+ * @brief Finish updating the data protected by a sequence lock
+ * @param lock The handle for a sequence lock
+ * @return 0 if the lock is successfully given
+ */
+__inline__ int metal_seqlock_write_end(struct metal_seqlock *lock) {
+    __asm__ volatile("fence rw, w" ::: "memory");
+    metal_atomic_add(&(lock->_seq), 1);
+
+    return 0;
+}
+
+/*!
+ * @brief Start reading the data protected by a sequence lock
+ * @param lock The handle for a sequence lock
+ * @return The sequence number to pass to metal_seqlock_read_retry()
+ */
+__inline__ unsigned int metal_seqlock_read_begin(struct metal_seqlock *lock) {
+    unsigned int seq;
+
+    while ((seq = lock->_seq) & 1)
+        ;
+    __asm__ volatile("fence r, r" ::: "memory");
+
+    return seq;
+}
+
+/*!
+ * @brief Check whether a read of data protected by a sequence lock raced with
+ * a writer
+ * @param lock The handle for a sequence lock
+ * @param seq The sequence number returned by metal_seqlock_read_begin()
+ * @return 0 if the data read is consistent, or 1 if it must be read again
+ */
+__inline__ int metal_seqlock_read_retry(struct metal_seqlock *lock,
+                                        unsigned int seq) {
+    __asm__ volatile("fence r, r" ::: "memory");
+
+    return (lock->_seq != seq);
+}
+
 #endif /* METAL__LOCK_H */
@@ -0,0 +1,151 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef METAL__MAILBOX_H
+#define METAL__MAILBOX_H
+
+/*!
+ * @file mailbox.h
+ * @brief An API for sending messages between harts
+ *
+ * Every hart has a mailbox, which is a lock-free queue that any hart may
+ * send messages to. Sending a message raises the software interrupt of the
+ * receiving hart, and the software interrupt handler hands every message
+ * which has arrived to the handler the receiving hart registered with
+ * metal_hart_mailbox_listen().
+ *
+ * The mailboxes also carry remote function calls, which run a function on a
+ * set of harts with metal_hart_call().
+ */
+
+#include <metal/atomic.h>
+
+/*! @brief The number of messages each mailbox holds. Must be a power of 2. */
+#ifndef METAL_HART_MAILBOX_DEPTH
+#define METAL_HART_MAILBOX_DEPTH 16
+#endif
+
+/*!
+ * @brief A message sent between harts
+ */
+struct metal_hart_message {
+    /*! @brief The hart which sent the message */
+    int sender;
+    /*! @brief A message type defined by the application, which must not be
+     * negative */
+    int type;
+    /*! @brief The payload of the message */
+    void *data;
+};
+
+/*!
+ * @brief The function called with each message a hart receives
+ * @param message The message, which is only valid until the handler returns
+ */
+typedef void (*metal_hart_message_handler_t)(
+    struct metal_hart_message *message);
+
+/*!
+ * @brief Start receiving messages on the current hart
+ *
+ * Registers the handler for messages to the current hart, and enables its
+ * software interrupt. The CPU interrupt controller must be initialized and
+ * machine interrupts must be enabled for messages to be delivered.
+ *
+ * The default software interrupt handler delivers the messages. An
+ * application which registers its own software interrupt handler must call
+ * metal_hart_mailbox_service() from it.
+ *
+ * A hart which only needs to receive remote function calls may pass a NULL
+ * handler, in which case other messages are dropped.
+ *
+ * @param handler The function called with each message, or NULL
+ * @return 0 on success, or -1 if the hart has no software interrupt
+ */
+int metal_hart_mailbox_listen(metal_hart_message_handler_t handler);
+
+/*!
+ * @brief Send a message to a hart
+ *
+ * The message is copied into the mailbox of the receiving hart, so the
+ * caller may reuse it once this returns. Messages from one sender are
+ * delivered in the order they were sent. This is safe to call from
+ * interrupt handlers.
+ *
+ * @param hartid The hart to send the message to
+ * @param type A message type defined by the application
+ * @param data The payload of the message
+ * @return 0 if the message was sent, -1 if the hart is not listening or the
+ * type is negative, or -2 if its mailbox is full
+ */
+int metal_hart_send(int hartid, int type, void *data);
+
+/*!
+ * @brief Deliver the messages waiting for the current hart
+ *
+ * Clears the software interrupt of the current hart and calls its message
+ * handler with every message in its mailbox, including messages which
+ * arrive while it runs. Remote function calls are run as they are reached.
+ *
+ * This must not be interrupted by the software interrupt handler of the same
+ * hart, so when it is called outside of an interrupt handler, machine
+ * interrupts must be disabled.
+ *
+ * @return The number of messages delivered, or -1 if the current hart is not
+ * listening
+ */
+int metal_hart_mailbox_service(void);
+
+/*!
+ * @brief A function run on other harts by metal_hart_call()
+ * @param arg The argument passed to metal_hart_call()
+ */
+typedef void (*metal_hart_call_fn_t)(void *arg);
+
+/*!
+ * @brief Run a function on a set of harts
+ *
+ * Sends a call to the mailbox of every hart in hartmask except the current
+ * hart, which then runs the function itself if it is in hartmask. Remote
+ * harts run the function from their software interrupt handler, so all of
+ * the selected harts run it in parallel.
+ *
+ * When wait is non-zero, this returns once every selected hart has returned
+ * from the function, and the memory accesses the function made on those harts
+ * are visible to the caller. While waiting, the current hart keeps delivering
+ * messages sent to it, so harts may call each other without deadlock.
+ *
+ * The function and its argument are shared by every hart, so results are
+ * returned through the argument, for example in an array indexed by the ID
+ * of the hart running the function.
+ *
+ * @param hartmask A bit mask of the harts to run the function on
+ * @param fn The function
+ * @param arg The argument passed to the function
+ * @param wait Whether to wait for the function to return on every hart
+ * @return 0 on success, or -1 if some of the harts in hartmask are not
+ * listening. The function still runs on the other harts.
+ */
+int metal_hart_call(unsigned long hartmask, metal_hart_call_fn_t fn, void *arg,
+                    int wait);
+
+/*!
+ * @brief Run a function on a set of harts without waiting for it
+ *
+ * Like metal_hart_call() without waiting, except that every hart which runs
+ * the function atomically increments *done once it returns. The caller can
+ * poll the counter to collect completions while it carries on with other
+ * work, and a single counter can track several batches of calls.
+ *
+ * @param hartmask A bit mask of the harts to run the function on
+ * @param fn The function
+ * @param arg The argument passed to the function
+ * @param done The completion counter, or NULL. It must stay valid until
+ * every hart has run the function.
+ * @return 0 on success, or -1 if some of the harts in hartmask are not
+ * listening
+ */
+int metal_hart_call_async(unsigned long hartmask, metal_hart_call_fn_t fn,
+                          void *arg, metal_atomic_t *done);
+
+#endif
@@ -0,0 +1,59 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef METAL__PERCPU_H
+#define METAL__PERCPU_H
+
+#include <stdint.h>
+
+/*!
+ * @file percpu.h
+ * @brief An API for per-hart variables
+ *
+ * Variables defined with METAL_PERCPU_DEFINE() are collected in the
+ * metal_percpu section, which only serves as a template. Before calling
+ * _start, every hart reserves its own copy of the section at the top of its
+ * stack, zeroes it, and stores the offset from the template to its copy in
+ * mscratch. METAL_PERCPU() then reaches the copy of the current hart with a
+ * CSR read and an add, without looking up the hart ID.
+ *
+ * Per-hart variables always start out zeroed, so they must not have
+ * initializers. The copies of different harts are in different cache lines.
+ *
+ * The startup code owns mscratch, so applications must not write it.
+ */
+
+/*!
+ * @brief Define a per-hart variable
+ *
+ * The name refers to the template, so the variable must always be accessed
+ * through METAL_PERCPU().
+ */
+#define METAL_PERCPU_DEFINE(type, name)                                        \
+    __attribute__((section("metal_percpu"))) type name
+
+/*!
+ * @brief Declare a per-hart variable defined in another file
+ */
+#define METAL_PERCPU_DECLARE(type, name) extern type name
+
+/*!
+ * @brief Access the copy of a per-hart variable belonging to the current hart
+ *
+ * This is an lvalue, so it can be read, assigned or have its address taken.
+ * The address is only valid on the current hart, and code which may migrate
+ * between harts must not keep it.
+ */
+#define METAL_PERCPU(name)                                                     \
+    (*(__typeof__(&(name)))((uintptr_t)&(name) + __metal_percpu_offset()))
+
+/* The offset of the per-hart variables of the current hart from their
+ * template. mscratch doesn't change after boot, so the read is not volatile
+ * and the compiler may reuse it. */
+__inline__ uintptr_t __metal_percpu_offset(void) {
+    uintptr_t offset;
+    __asm__("csrr %0, mscratch" : "=r"(offset));
+    return offset;
+}
+
+#endif
@@ -35,12 +35,53 @@ struct metal_spi_config {
     } multi_wire;
 };
 
+/*! @brief The read instruction used when a SPI flash is memory-mapped
+ *
+ * The protocol fields take the same values as metal_spi_config.protocol.
+ */
+struct metal_spi_flash_format {
+    /*! @brief Send cmd_code at the start of every read. Clear it for flash
+     * devices which have been put into continuous read mode. */
+    unsigned int cmd_en : 1;
+    /*! @brief The number of address bytes, from 0 to 4 */
+    unsigned int addr_len;
+    /*! @brief The number of dummy cycles between the address and the data,
+     * from 0 to 15 */
+    unsigned int pad_cnt;
+    /*! @brief The protocol used to send the command */
+    unsigned int cmd_protocol;
+    /*! @brief The protocol used to send the address and dummy cycles */
+    unsigned int addr_protocol;
+    /*! @brief The protocol used to receive the data */
+    unsigned int data_protocol;
+    /*! @brief The read command, such as 0x03 or 0xEB */
+    unsigned char cmd_code;
+    /*! @brief The value driven during the first dummy cycles, used to select
+     * continuous read mode on some flash devices */
+    unsigned char pad_code;
+};
+
+/*! @brief Completion callback for an asynchronous SPI transfer
+ * @param spi The handle for the SPI device which performed the transfer
+ * @param status 0 if the transfer succeeded
+ * @param priv The private data passed to metal_spi_transfer_async()
+ */
+typedef void (*metal_spi_callback_t)(struct metal_spi *spi, int status,
+                                     void *priv);
+
 struct metal_spi_vtable {
     void (*init)(struct metal_spi *spi, int baud_rate);
     int (*transfer)(struct metal_spi *spi, struct metal_spi_config *config,
                     size_t len, char *tx_buf, char *rx_buf);
+    int (*transfer_async)(struct metal_spi *spi,
+                          struct metal_spi_config *config, size_t len,
+                          char *tx_buf, char *rx_buf,
+                          metal_spi_callback_t callback, void *priv);
     int (*get_baud_rate)(struct metal_spi *spi);
     int (*set_baud_rate)(struct metal_spi *spi, int baud_rate);
+    int (*set_flash_format)(struct metal_spi *spi,
+                            struct metal_spi_flash_format *format);
+    int (*set_flash_mapped)(struct metal_spi *spi, int enable);
 };
 
 /*! @brief A handle for a SPI device */
@@ -77,6 +118,42 @@ __inline__ int metal_spi_transfer(struct metal_spi *spi,
     return spi->vtable->transfer(spi, config, len, tx_buf, rx_buf);
 }
 
+/*! @brief Queue an interrupt-driven SPI transfer
+ *
+ * The transfer is queued behind any asynchronous transfers already pending
+ * on the device and is driven by the SPI interrupts, so this call returns
+ * immediately. The callback is normally called from interrupt context once
+ * the transfer completes. A transfer which completes as soon as it starts,
+ * or whose configuration can't be applied, calls the callback before this
+ * returns, from the context of the caller. The interrupt controller of the
+ * SPI device must be initialized and interrupts must be enabled on the CPU.
+ *
+ * The configuration and both buffers must remain valid until the callback
+ * is called. metal_spi_transfer() fails while asynchronous transfers are
+ * pending.
+ *
+ * @param spi The handle for the SPI device to perform the transfer
+ * @param config The configuration for the SPI transfer.
+ * @param len The number of bytes to transfer
+ * @param tx_buf The buffer to send over the SPI bus. Must be len bytes long. If
+ * NULL, the SPI will transfer the value 0.
+ * @param rx_buf The buffer to receive data into. Must be len bytes long. If
+ * NULL, the SPI will ignore received bytes.
+ * @param callback The function to call when the transfer completes, or NULL
+ * @param priv Private data passed to the callback
+ * @return 0 if the transfer is queued, or -1 if the queue is full or the
+ * device has no interrupt
+ */
+__inline__ int metal_spi_transfer_async(struct metal_spi *spi,
+                                        struct metal_spi_config *config,
+                                        size_t len, char *tx_buf,
+                                        char *rx_buf,
+                                        metal_spi_callback_t callback,
+                                        void *priv) {
+    return spi->vtable->transfer_async(spi, config, len, tx_buf, rx_buf,
+                                       callback, priv);
+}
+
 /*! @brief Get the current baud rate of the SPI device
  * @param spi The handle for the SPI device
  * @return The baud rate in Hz
@@ -94,4 +171,38 @@ __inline__ int metal_spi_set_baud_rate(struct metal_spi *spi, int baud_rate) {
     return spi->vtable->set_baud_rate(spi, baud_rate);
 }
 
+/*! @brief Set the read instruction used by the memory-mapped flash interface
+ *
+ * The format takes effect on the next read from the memory-mapped flash, so it
+ * is safe to change while executing from that flash as long as the flash
+ * device has already been configured to accept the new instruction.
+ *
+ * @param spi The handle for the SPI device
+ * @param format The read instruction format
+ * @return 0 if the format is set, or -1 if it is out of range or the device
+ * has no memory-mapped flash interface
+ */
+__inline__ int
+metal_spi_set_flash_format(struct metal_spi *spi,
+                           struct metal_spi_flash_format *format) {
+    return spi->vtable->set_flash_format(spi, format);
+}
+
+/*! @brief Switch the flash interface between memory-mapped and programmed I/O
+ *
+ * SPI transfers always run in programmed I/O mode. While memory-mapped mode is
+ * enabled, metal_spi_transfer() leaves it only for the duration of the
+ * transfer and switches back before returning. Code which executes from the
+ * memory-mapped flash must not perform transfers on the same device, or
+ * disable memory-mapped mode, since its instructions cannot be fetched in
+ * programmed I/O mode.
+ *
+ * @param spi The handle for the SPI device
+ * @param enable 1 for memory-mapped mode, 0 for programmed I/O mode
+ * @return 0 if the mode is switched, or -1 while a transfer is in progress
+ */
+__inline__ int metal_spi_set_flash_mapped(struct metal_spi *spi, int enable) {
+    return spi->vtable->set_flash_mapped(spi, enable);
+}
+
 #endif
@@ -0,0 +1,214 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef METAL__THREAD_H
+#define METAL__THREAD_H
+
+#include <metal/lock.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * @file thread.h
+ * @brief An API for lightweight threads
+ *
+ * Each hart runs its own threads from its own run queue, round robin.
+ * Threads never move between harts: a thread runs on the hart which created
+ * it. The code which first uses the API on a hart, usually main(), becomes
+ * the main thread of that hart and keeps running on the hart's stack.
+ *
+ * Threads switch on metal_thread_yield(), when they block on a semaphore or
+ * mutex, and, once metal_thread_preempt_start() has been called, when their
+ * time slice runs out. Preemption takes place at the end of the timer
+ * interrupt, by switching threads from inside the interrupt handler, so the
+ * interrupted thread resumes in its handler and returns from the interrupt
+ * when it next runs.
+ *
+ * A context switch saves the callee saved integer and floating point
+ * registers along with mepc and mstatus. The caller saved registers are
+ * saved by the C calling convention, or by the interrupt handler when the
+ * switch is a preemption. Vector registers are not saved.
+ *
+ * When no thread of a hart can run, the hart waits for interrupts. A
+ * thread which is woken by another hart is picked up at the next interrupt
+ * of its own hart, so harts which share semaphores should run a time slice.
+ */
+
+/*!
+ * @brief The function a thread runs
+ * @param arg The argument passed to metal_thread_create()
+ */
+typedef void (*metal_thread_entry_t)(void *arg);
+
+/*!
+ * @brief A thread control block
+ *
+ * Thread control blocks belong to the caller, who must keep them valid for
+ * as long as the thread exists. Its fields are private.
+ */
+struct metal_thread {
+    /* The stack pointer of the thread while it is not running */
+    uintptr_t _sp;
+    /* The next thread in the run queue or wait queue */
+    struct metal_thread *_next;
+    volatile int _state;
+    int _hartid;
+    metal_thread_entry_t _entry;
+    void *_arg;
+};
+
+/*!
+ * @brief A counting semaphore which blocks threads
+ *
+ * The semaphore may be posted by threads on any hart and by interrupt
+ * handlers. It must be initialized with metal_thread_sem_init().
+ */
+struct metal_thread_sem {
+    struct metal_lock _lock;
+    int _count;
+    struct metal_thread *_head;
+    struct metal_thread *_tail;
+};
+
+/*!
+ * @brief A mutex which blocks threads
+ *
+ * The mutex is a semaphore with a count of one. It must be initialized with
+ * metal_thread_mutex_init().
+ */
+struct metal_thread_mutex {
+    struct metal_thread_sem _sem;
+};
+
+/*!
+ * @brief Create a thread on the current hart
+ *
+ * The new thread is added to the end of the run queue of the current hart,
+ * and first runs when the current thread yields, blocks or is preempted. It
+ * runs with machine interrupts enabled. When the entry function returns,
+ * the thread exits.
+ *
+ * @param thread The thread control block
+ * @param entry The function the thread runs
+ * @param arg Passed to the entry function
+ * @param stack The stack of the thread
+ * @param stack_size The size of the stack in bytes
+ * @return 0 on success, or -1 if the stack is too small or the run queue of
+ * the current hart can't be locked
+ */
+int metal_thread_create(struct metal_thread *thread, metal_thread_entry_t entry,
+                        void *arg, void *stack, size_t stack_size);
+
+/*!
+ * @brief Get the running thread
+ * @return The thread running on the current hart
+ */
+struct metal_thread *metal_thread_self(void);
+
+/*!
+ * @brief Let the other threads of the current hart run
+ *
+ * The current thread goes to the end of the run queue.
+ */
+void metal_thread_yield(void);
+
+/*!
+ * @brief Exit the current thread
+ *
+ * The hart keeps using the stack of the thread until it switches to another
+ * of its threads, and waits for interrupts on it if none is ready. Only
+ * once metal_thread_exited() returns 1 may the thread control block and the
+ * stack be reused. If the main thread of a hart exits, the hart only runs
+ * its other threads.
+ */
+void metal_thread_exit(void) __attribute__((noreturn));
+
+/*!
+ * @brief Check whether a thread has finished exiting
+ * @param thread The thread
+ * @return 1 once the thread has exited and the hart no longer uses its
+ * stack, 0 otherwise
+ */
+int metal_thread_exited(struct metal_thread *thread);
+
+/*!
+ * @brief Preempt the threads of the current hart when their time runs out
+ *
+ * Arms a periodic software timer with metal_timer_add(), which makes the
+ * running thread yield at the end of the timer interrupt once every slice.
+ * The CPU interrupt controller must be initialized and machine interrupts
+ * must be enabled.
+ *
+ * Preemption needs the CLINT, and fails on targets without one even though
+ * the software timers work there. With the CLIC, the interrupt level of
+ * the preempted thread would stay in effect, so the CLIC interrupt handlers
+ * don't switch threads, and threads can only yield.
+ *
+ * @param slice The length of a time slice in ticks of mtime
+ * @return 0 on success, or -1 if the target has no CLINT or the timer
+ * interrupt of the current hart can't be used
+ */
+int metal_thread_preempt_start(unsigned long long slice);
+
+/*!
+ * @brief Initialize a semaphore
+ * @param sem The semaphore
+ * @param count The initial count
+ * @return 0 if the semaphore is successfully initialized. A non-zero code
+ * indicates failure, see metal_lock_init().
+ *
+ * On harts without atomics the semaphore is only protected by disabling
+ * interrupts, so it must not be shared between harts.
+ */
+int metal_thread_sem_init(struct metal_thread_sem *sem, int count);
+
+/*!
+ * @brief Take a semaphore, blocking until its count is above zero
+ * @param sem The semaphore
+ *
+ * Must be called from a thread, not from an interrupt handler.
+ */
+void metal_thread_sem_wait(struct metal_thread_sem *sem);
+
+/*!
+ * @brief Take a semaphore if its count is above zero
+ * @param sem The semaphore
+ * @return 0 if the semaphore was taken, or -1 if it wasn't available
+ */
+int metal_thread_sem_trywait(struct metal_thread_sem *sem);
+
+/*!
+ * @brief Post a semaphore, waking the thread which has waited longest
+ * @param sem The semaphore
+ *
+ * May be called from interrupt handlers and from any hart.
+ */
+void metal_thread_sem_post(struct metal_thread_sem *sem);
+
+/*!
+ * @brief Initialize a mutex
+ * @param mutex The mutex
+ * @return 0 if the mutex is successfully initialized. A non-zero code
+ * indicates failure, see metal_lock_init().
+ */
+__inline__ int metal_thread_mutex_init(struct metal_thread_mutex *mutex) {
+    return metal_thread_sem_init(&mutex->_sem, 1);
+}
+
+/*!
+ * @brief Lock a mutex, blocking until it is unlocked
+ * @param mutex The mutex
+ */
+__inline__ void metal_thread_mutex_lock(struct metal_thread_mutex *mutex) {
+    metal_thread_sem_wait(&mutex->_sem);
+}
+
+/*!
+ * @brief Unlock a mutex
+ * @param mutex The mutex
+ */
+__inline__ void metal_thread_mutex_unlock(struct metal_thread_mutex *mutex) {
+    metal_thread_sem_post(&mutex->_sem);
+}
+
+#endif
@@ -4,6 +4,7 @@
 #ifndef METAL__TIME_H
 #define METAL__TIME_H
 
+#include <stdint.h>
 #include <time.h>
 
 #include <sys/time.h>
@@ -17,4 +18,216 @@ int metal_gettimeofday(struct timeval *tp, void *tzp);
 
 time_t metal_time(void);
 
+/*!
+ * @brief Precomputed factors for converting timer ticks to time
+ *
+ * The divisions by the tick rate are done once, in metal_time_scale_init(),
+ * so converting ticks only takes multiplications. This matters on RV32,
+ * where every 64-bit division is a call to libgcc.
+ */
+struct metal_time_scale {
+    /*! @brief The tick rate in Hz */
+    unsigned long long hz;
+    /* floor((2^64 - 1) / hz) */
+    unsigned long long _recip;
+    /* floor(10^9 * 2^32 / hz) */
+    unsigned long long _ns_mult;
+    /* ceil(hz * 2^32 / 10^9) */
+    unsigned long long _tick_mult;
+};
+
+/*!
+ * @brief Compute the conversion factors for a tick rate
+ * @param scale The factors to compute
+ * @param hz The tick rate in Hz
+ * @return 0 on success, or -1 if hz is 0
+ */
+int metal_time_scale_init(struct metal_time_scale *scale,
+                          unsigned long long hz);
+
+/*!
+ * @brief Get the conversion factors for the timebase of the timer
+ *
+ * The factors are shared by gettimeofday(), times() and
+ * metal_gettimeofday(), and are computed again whenever the timebase
+ * reported by metal_timer_get_timebase_frequency() changes.
+ *
+ * @return The factors, or NULL if the timebase is unknown
+ */
+const struct metal_time_scale *metal_time_scale_timebase(void);
+
+/* The high 64 bits of the 128-bit product of a and b */
+__inline__ unsigned long long __metal_time_mulhi(unsigned long long a,
+                                                 unsigned long long b) {
+#if __riscv_xlen == 64
+    return ((unsigned __int128)a * b) >> 64;
+#else
+    uint32_t al = a, ah = a >> 32, bl = b, bh = b >> 32;
+    unsigned long long ll = (unsigned long long)al * bl;
+    unsigned long long lh = (unsigned long long)al * bh;
+    unsigned long long hl = (unsigned long long)ah * bl;
+    unsigned long long hh = (unsigned long long)ah * bh;
+    unsigned long long mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+
+    return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+/*!
+ * @brief Split a tick count into whole seconds and the remaining ticks
+ * @param scale The conversion factors
+ * @param ticks The tick count
+ * @param frac Set to the ticks left over after the whole seconds
+ * @return The number of whole seconds
+ */
+__inline__ unsigned long long
+metal_time_scale_split(const struct metal_time_scale *scale,
+                       unsigned long long ticks, unsigned long long *frac) {
+    unsigned long long sec = __metal_time_mulhi(ticks, scale->_recip);
+    unsigned long long rem = ticks - sec * scale->hz;
+
+    /* The reciprocal is rounded down, so the quotient is at most 2 short */
+    while (rem >= scale->hz) {
+        rem -= scale->hz;
+        sec++;
+    }
+    *frac = rem;
+    return sec;
+}
+
+/*!
+ * @brief Convert the ticks left over from metal_time_scale_split() to
+ * nanoseconds
+ * @param scale The conversion factors
+ * @param frac A number of ticks less than one second
+ * @return The number of nanoseconds, which is less than 10^9. It may be up
+ * to 1 ns short for tick rates below 2^32 Hz.
+ */
+__inline__ unsigned long
+metal_time_scale_ns(const struct metal_time_scale *scale,
+                    unsigned long long frac) {
+    /* frac < hz, so the product is less than 10^9 * 2^32 */
+    return (frac * scale->_ns_mult) >> 32;
+}
+
+/*!
+ * @brief Convert a duration to ticks, rounding up
+ * @param scale The conversion factors
+ * @param sec The whole seconds of the duration
+ * @param ns The nanoseconds of the duration, less than 10^9
+ * @return The number of ticks
+ */
+__inline__ unsigned long long
+metal_time_scale_ticks(const struct metal_time_scale *scale,
+                       unsigned long long sec, unsigned long ns) {
+    unsigned long long ticks = sec * scale->hz;
+
+    if (ns) {
+        /* (ns * _tick_mult) >> 32, which may not fit in 64 bits */
+        ticks += __metal_time_mulhi((unsigned long long)ns << 32,
+                                    scale->_tick_mult) +
+                 1;
+    }
+    return ticks;
+}
+
+/*!
+ * @brief Wait for a duration
+ *
+ * When the software timers of metal_timer_add() are already running on the
+ * current hart, it arms one for the end of the wait and sleeps in WFI until
+ * mtime reaches it, so other interrupts are still taken while it waits.
+ * Otherwise mtimecmp may belong to the application, so the hart polls mtime
+ * and leaves the timer interrupt alone. Waits shorter than
+ * METAL_DELAY_SPIN_TICKS ticks of the timebase always poll.
+ *
+ * The wait is rounded up to a whole number of ticks of the timebase.
+ *
+ * @param sec The whole seconds to wait
+ * @param ns The nanoseconds to wait, less than 10^9
+ * @return 0 once the time has passed, or -1 if there is no timer
+ */
+int metal_delay(unsigned long long sec, unsigned long ns);
+
+/*!
+ * @brief Wait for a number of microseconds
+ *
+ * See metal_delay().
+ *
+ * @param us The number of microseconds to wait
+ * @return 0 once the time has passed, or -1 if there is no timer
+ */
+int metal_delay_us(unsigned long us);
+
+/*!
+ * @brief A timeout expressed as an absolute cycle count
+ *
+ * Deadlines are compared against the raw cycle counter, so checking one
+ * needs no division. The cycle counter is scaled by the same timebase as
+ * metal_timer_get_cyclecount().
+ */
+struct metal_deadline {
+    unsigned long long expires;
+    unsigned long long ticks;
+};
+
+/*!
+ * @brief Read the raw cycle counter of the current hart
+ * @return The value of mcycle
+ */
+__inline__ unsigned long long metal_deadline_now(void) {
+#if __riscv_xlen == 32
+    unsigned long hi, hi1, lo;
+
+    do {
+        __asm__ volatile("csrr %0, mcycleh" : "=r"(hi));
+        __asm__ volatile("csrr %0, mcycle" : "=r"(lo));
+        __asm__ volatile("csrr %0, mcycleh" : "=r"(hi1));
+    } while (hi != hi1);
+
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    unsigned long long val;
+
+    __asm__ volatile("csrr %0, mcycle" : "=r"(val));
+    return val;
+#endif
+}
+
+/*!
+ * @brief Convert a duration in microseconds to cycle counter ticks
+ * @param us The duration in microseconds
+ * @return The number of ticks, or 0 if the timebase is unknown
+ */
+unsigned long long metal_deadline_us_to_ticks(unsigned long us);
+
+/*!
+ * @brief Initialize and arm a deadline
+ *
+ * The conversion from microseconds is done once here, so the deadline can be
+ * re-armed for the same duration with metal_deadline_rearm() without any
+ * division.
+ *
+ * @param deadline The deadline to initialize
+ * @param us The duration of the timeout in microseconds
+ */
+void metal_deadline_init_us(struct metal_deadline *deadline, unsigned long us);
+
+/*!
+ * @brief Re-arm a deadline for the duration it was initialized with
+ * @param deadline The deadline to re-arm
+ */
+__inline__ void metal_deadline_rearm(struct metal_deadline *deadline) {
+    deadline->expires = metal_deadline_now() + deadline->ticks;
+}
+
+/*!
+ * @brief Check whether a deadline has passed
+ * @param deadline The deadline to check
+ * @return 1 if the deadline has passed, 0 otherwise
+ */
+__inline__ int metal_deadline_expired(const struct metal_deadline *deadline) {
+    return (long long)(metal_deadline_now() - deadline->expires) > 0;
+}
+
 #endif
@@ -4,11 +4,79 @@
 #ifndef METAL__TIMER_H
 #define METAL__TIMER_H
 
+#include <metal/io.h>
+#include <metal/machine.h>
+#include <stdint.h>
+
 /*!
  * @file timer.h
  * @brief API for reading and manipulating the machine timer
  */
 
+/* Read a 64-bit memory-mapped timer register */
+__inline__ unsigned long long __metal_mtime_read_mmio(uintptr_t addr) {
+#if __riscv_xlen == 64
+    /* A single load can't tear */
+    return __METAL_ACCESS_ONCE((__metal_io_u64 *)addr);
+#else
+    __metal_io_u32 lo, hi;
+
+    /* Guard against rollover when reading */
+    do {
+        hi = __METAL_ACCESS_ONCE((__metal_io_u32 *)(addr + 4));
+        lo = __METAL_ACCESS_ONCE((__metal_io_u32 *)addr);
+    } while (__METAL_ACCESS_ONCE((__metal_io_u32 *)(addr + 4)) != hi);
+
+    return (((unsigned long long)hi) << 32) | lo;
+#endif
+}
+
+/* Whether the software timers own mtimecmp on hartid */
+int __metal_timer_wheel_active(int hartid);
+
+/*!
+ * @brief Read mtime
+ *
+ * Reads the timer directly, rather than through the interrupt controller
+ * driver like metal_cpu_get_mtime(). When freedom-metal is built with
+ * METAL_RISCV_TIME_CSR defined, the time CSR is read instead of the timer
+ * registers, which is only valid on harts that implement it.
+ *
+ * @return The value of mtime, or 0 if there is no timer
+ */
+__inline__ unsigned long long metal_mtime_read(void) {
+#if defined(METAL_RISCV_TIME_CSR)
+#if __riscv_xlen == 64
+    unsigned long long time;
+
+    __asm__ volatile("csrr %0, time" : "=r"(time));
+    return time;
+#else
+    unsigned long hi, hi1, lo;
+
+    do {
+        __asm__ volatile("csrr %0, timeh" : "=r"(hi));
+        __asm__ volatile("csrr %0, time" : "=r"(lo));
+        __asm__ volatile("csrr %0, timeh" : "=r"(hi1));
+    } while (hi != hi1);
+
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+#elif defined(METAL_RISCV_CLINT0) && defined(__METAL_DT_RISCV_CLINT0_HANDLE)
+    return __metal_mtime_read_mmio(
+        __metal_driver_sifive_clint0_control_base(
+            (struct metal_interrupt *)__METAL_DT_RISCV_CLINT0_HANDLE) +
+        METAL_RISCV_CLINT0_MTIME);
+#elif defined(METAL_SIFIVE_CLIC0) && defined(__METAL_DT_SIFIVE_CLIC0_HANDLE)
+    return __metal_mtime_read_mmio(
+        __metal_driver_sifive_clic0_control_base(
+            (struct metal_interrupt *)__METAL_DT_SIFIVE_CLIC0_HANDLE) +
+        METAL_SIFIVE_CLIC0_MTIME);
+#else
+    return 0;
+#endif
+}
+
 /*!
  * @brief Read the machine cycle count
  * @param hartid The hart ID to read the cycle count of
@@ -34,4 +102,90 @@ int metal_timer_get_timebase_frequency(int hartid,
  */
 int metal_timer_set_tick(int hartid, int second);
 
+struct metal_timer;
+
+/*!
+ * @brief The function called when a software timer expires
+ * @param timer The timer, which is no longer pending and may be added again
+ * @param data The data passed when the timer was added
+ */
+typedef void (*metal_timer_callback_t)(struct metal_timer *timer, void *data);
+
+/*!
+ * @brief A software timer
+ *
+ * Each hart keeps its software timers in a hashed timer wheel and programs
+ * its mtimecmp with the earliest deadline, so any number of timers share the
+ * machine timer interrupt of the hart. The timer belongs to the caller, who
+ * must zero it before it is first added and keep it valid while it is
+ * pending. Its fields are private.
+ */
+struct metal_timer {
+    unsigned long long _deadline;
+    metal_timer_callback_t _callback;
+    void *_data;
+    struct metal_timer *_next;
+    struct metal_timer **_pprev;
+    int _hartid;
+    int _slot;
+};
+
+/*!
+ * @brief Start a software timer on the current hart
+ *
+ * The timer interrupt of the current hart is enabled the first time a timer
+ * is added on it. The CPU interrupt controller must be initialized and
+ * machine interrupts must be enabled for timers to expire.
+ *
+ * The callback runs from the timer interrupt handler of the current hart.
+ * The default timer interrupt handler runs the timers. An application which
+ * registers its own timer interrupt handler must call metal_timer_service()
+ * from it.
+ *
+ * @param timer The timer
+ * @param deadline The value of mtime at which the timer expires
+ * @param callback The function called when the timer expires
+ * @param data Passed to the callback
+ * @return 0 on success, -1 if the hart has no timer interrupt, or -2 if the
+ * timer is already pending
+ */
+int metal_timer_add(struct metal_timer *timer, unsigned long long deadline,
+                    metal_timer_callback_t callback, void *data);
+
+/*!
+ * @brief Stop a software timer
+ *
+ * Must be called on the hart the timer was added on.
+ *
+ * @param timer The timer
+ * @return 0 if the timer was stopped, 1 if it was not pending, or -1 if it
+ * belongs to another hart
+ */
+int metal_timer_cancel(struct metal_timer *timer);
+
+/*!
+ * @brief Change the deadline of a software timer
+ *
+ * Restarts the timer with the callback and data it was last added with,
+ * whether it is pending or has already expired. Must be called on the hart
+ * the timer was added on.
+ *
+ * @param timer The timer, which must have been added before
+ * @param deadline The value of mtime at which the timer expires
+ * @return 0 on success, or -1 if the timer was never added or belongs to
+ * another hart
+ */
+int metal_timer_modify(struct metal_timer *timer, unsigned long long deadline);
+
+/*!
+ * @brief Run the expired software timers of the current hart
+ *
+ * Calls the callback of every expired timer and programs mtimecmp with the
+ * next deadline. This must run in the timer interrupt handler.
+ *
+ * @return The number of timers which expired, or -1 if no timer was ever
+ * added on the current hart
+ */
+int metal_timer_service(void);
+
 #endif
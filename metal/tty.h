@@ -4,6 +4,8 @@
 #ifndef METAL__TTY_H
 #define METAL__TTY_H
 
+#include <stddef.h>
+
 /*!
  * @file tty.h
  * @brief API for emulated serial teriminals
@@ -23,6 +25,19 @@
  */
 int metal_tty_putc(int c);
 
+/*!
+ * @brief Write a buffer of characters to the default output device
+ *
+ * Write a buffer to the default output device, which for most targets is
+ * the UART serial port. Like putc(), write() does CR/LF mapping, but hands
+ * the device whole runs of characters at a time.
+ *
+ * @param buf The characters to write to the terminal
+ * @param len The number of characters in buf
+ * @return The number of characters written, or -1 on failure.
+ */
+int metal_tty_write(const char *buf, size_t len);
+
 /*!
  * @brief Write a raw character to the default output device
  *
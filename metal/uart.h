@@ -12,11 +12,28 @@
 #include <metal/interrupt.h>
 
 struct metal_uart;
+
+/*!
+ * @brief Counters describing the state of a buffered UART
+ */
+struct metal_uart_stats {
+    /*! Bytes refused by metal_uart_write() because the transmit buffer was
+     * full */
+    unsigned long tx_overflow;
+    /*! Bytes dropped because they arrived while the receive buffer was full */
+    unsigned long rx_overflow;
+    /*! The largest number of bytes ever held in the transmit buffer */
+    size_t tx_high_water;
+    /*! The largest number of bytes ever held in the receive buffer */
+    size_t rx_high_water;
+};
+
 #undef getc
 #undef putc
 struct metal_uart_vtable {
     void (*init)(struct metal_uart *uart, int baud_rate);
     int (*putc)(struct metal_uart *uart, int c);
+    int (*write_buf)(struct metal_uart *uart, const char *buf, size_t len);
     int (*txready)(struct metal_uart *uart);
     int (*getc)(struct metal_uart *uart, int *c);
     int (*get_baud_rate)(struct metal_uart *uart);
@@ -31,6 +48,11 @@ struct metal_uart_vtable {
     size_t (*get_tx_watermark)(struct metal_uart *uart);
     int (*set_rx_watermark)(struct metal_uart *uart, size_t length);
     size_t (*get_rx_watermark)(struct metal_uart *uart);
+    int (*set_buffers)(struct metal_uart *uart, char *tx_buf, size_t tx_len,
+                       char *rx_buf, size_t rx_len);
+    int (*write)(struct metal_uart *uart, const char *buf, size_t len);
+    int (*read)(struct metal_uart *uart, char *buf, size_t len);
+    int (*get_stats)(struct metal_uart *uart, struct metal_uart_stats *stats);
 };
 
 /*!
@@ -70,6 +92,22 @@ __inline__ int metal_uart_putc(struct metal_uart *uart, int c) {
     return uart->vtable->putc(uart, c);
 }
 
+/*!
+ * @brief Output a buffer of characters over the UART
+ *
+ * Blocks until every character has been handed to the UART. No CR/LF
+ * translation is performed.
+ *
+ * @param uart The UART device handle
+ * @param buf The characters to send over the UART
+ * @param len The number of characters in buf
+ * @return 0 upon success
+ */
+__inline__ int metal_uart_write_buf(struct metal_uart *uart, const char *buf,
+                                    size_t len) {
+    return uart->vtable->write_buf(uart, buf, len);
+}
+
 /*!
  * @brief Test, determine if tx output is blocked(full/busy)
  * @param uart The UART device handle
@@ -212,4 +250,62 @@ __inline__ size_t metal_uart_get_receive_watermark(struct metal_uart *uart) {
     return uart->vtable->get_rx_watermark(uart);
 }
 
+/*!
+ * @brief Enable interrupt-driven buffered operation of the UART
+ *
+ * In buffered mode, transmitted bytes are queued in tx_buf and drained into
+ * the UART FIFO by the transmit watermark interrupt, and received bytes are
+ * moved from the UART FIFO into rx_buf by the receive watermark interrupt.
+ * metal_uart_putc() and metal_uart_getc() also go through the buffers.
+ *
+ * The lengths of both buffers must be powers of two. The interrupt
+ * controller of the UART must be initialized and interrupts must be enabled
+ * on the CPU for the buffers to drain. Passing NULL for both buffers returns
+ * the UART to polled operation.
+ *
+ * @param uart The UART device handle
+ * @param tx_buf The storage for the transmit buffer
+ * @param tx_len The length of tx_buf in bytes
+ * @param rx_buf The storage for the receive buffer
+ * @param rx_len The length of rx_buf in bytes
+ * @return 0 upon success
+ */
+int metal_uart_set_buffers(struct metal_uart *uart, char *tx_buf,
+                           size_t tx_len, char *rx_buf, size_t rx_len);
+
+/*!
+ * @brief Write bytes to the UART without blocking
+ *
+ * In buffered mode the bytes are queued in the transmit buffer. Otherwise,
+ * bytes are written directly to the UART FIFO until it is full.
+ *
+ * @param uart The UART device handle
+ * @param buf The bytes to write
+ * @param len The number of bytes to write
+ * @return The number of bytes accepted, or -1 on failure
+ */
+int metal_uart_write(struct metal_uart *uart, const char *buf, size_t len);
+
+/*!
+ * @brief Read bytes from the UART without blocking
+ *
+ * In buffered mode the bytes are taken from the receive buffer. Otherwise,
+ * bytes are read directly from the UART FIFO until it is empty.
+ *
+ * @param uart The UART device handle
+ * @param buf The buffer to hold the received bytes
+ * @param len The size of buf in bytes
+ * @return The number of bytes read, or -1 on failure
+ */
+int metal_uart_read(struct metal_uart *uart, char *buf, size_t len);
+
+/*!
+ * @brief Get the buffer counters of the UART
+ * @param uart The UART device handle
+ * @param stats The structure to fill with the current counters
+ * @return 0 upon success
+ */
+int metal_uart_get_stats(struct metal_uart *uart,
+                         struct metal_uart_stats *stats);
+
 #endif
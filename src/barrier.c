@@ -0,0 +1,149 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/barrier.h>
+#include <metal/cpu.h>
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/memory.h>
+
+int metal_hart_barrier_init(struct metal_hart_barrier *barrier, int harts) {
+#ifdef __riscv_atomic
+    /* Get a handle for the memory which holds the barrier state */
+    struct metal_memory *barrier_mem =
+        metal_get_memory_from_address((uintptr_t) & (barrier->_count));
+    if (!barrier_mem) {
+        return 1;
+    }
+
+    /* If the memory doesn't support atomics, report an error */
+    if (!metal_memory_supports_atomics(barrier_mem)) {
+        return 2;
+    }
+
+    if ((harts < 1) || (harts > __METAL_DT_MAX_HARTS)) {
+        return 4;
+    }
+
+    barrier->_count = 0;
+    barrier->_sense = 0;
+    barrier->_harts = harts;
+    for (int i = 0; i < __METAL_DT_MAX_HARTS; i++) {
+        barrier->_hart[i]._sense = 0;
+        barrier->_hart[i]._asleep = 0;
+    }
+    __asm__ volatile("fence rw, rw" ::: "memory");
+
+    return 0;
+#else
+    return 3;
+#endif
+}
+
+/* Only linked in when the application uses the hart mailboxes */
+int metal_hart_mailbox_service(void) __attribute__((weak));
+
+/* Clear the wakeup. The hart mailboxes share the software interrupt, so
+ * deliver whatever was sent to this hart as well, which would otherwise be
+ * dropped along with the interrupt. */
+static void __metal_hart_barrier_ack(struct metal_cpu *cpu, int hartid) {
+    metal_cpu_software_clear_ipi(cpu, hartid);
+    if (metal_hart_mailbox_service) {
+        metal_hart_mailbox_service();
+    }
+}
+
+/* Sleep until the barrier reaches sense. The releasing hart publishes the
+ * sense before it checks _asleep, and this hart sets _asleep before it
+ * checks the sense, so one of them always sees the other. */
+static void __metal_hart_barrier_sleep(struct metal_hart_barrier *barrier,
+                                       int hartid, int sense) {
+    struct metal_cpu *cpu = metal_cpu_get(hartid);
+    unsigned long mstatus, mie;
+
+    /* Without a software interrupt controller nobody can wake us up */
+    if ((cpu == NULL) || (metal_cpu_software_clear_ipi(cpu, hartid) != 0)) {
+        while (barrier->_sense != sense)
+            ;
+        return;
+    }
+
+    __asm__ volatile("csrrc %0, mstatus, %1"
+                     : "=r"(mstatus)
+                     : "r"(METAL_MSTATUS_MIE));
+    __asm__ volatile("csrrs %0, mie, %1"
+                     : "=r"(mie)
+                     : "r"(METAL_LOCAL_INTERRUPT_SW));
+    __metal_hart_barrier_ack(cpu, hartid);
+
+    barrier->_hart[hartid]._asleep = 1;
+    __asm__ volatile("fence rw, rw" ::: "memory");
+
+    while (barrier->_sense != sense) {
+        __asm__ volatile("wfi");
+        __metal_hart_barrier_ack(cpu, hartid);
+
+        /* Let any other interrupt which woke us be handled, keeping a
+         * wakeup which arrives meanwhile pending */
+        if (mstatus & METAL_MSTATUS_MIE) {
+            __asm__ volatile("csrc mie, %0" ::"r"(METAL_LOCAL_INTERRUPT_SW));
+            __asm__ volatile("csrs mstatus, %0" ::"r"(METAL_MSTATUS_MIE));
+            __asm__ volatile("csrc mstatus, %0" ::"r"(METAL_MSTATUS_MIE));
+            __asm__ volatile("csrs mie, %0" ::"r"(METAL_LOCAL_INTERRUPT_SW));
+        }
+    }
+
+    barrier->_hart[hartid]._asleep = 0;
+    __metal_hart_barrier_ack(cpu, hartid);
+
+    if (!(mie & METAL_LOCAL_INTERRUPT_SW)) {
+        __asm__ volatile("csrc mie, %0" ::"r"(METAL_LOCAL_INTERRUPT_SW));
+    }
+    if (mstatus & METAL_MSTATUS_MIE) {
+        __asm__ volatile("csrs mstatus, %0" ::"r"(METAL_MSTATUS_MIE));
+    }
+}
+
+int metal_hart_barrier_wait(struct metal_hart_barrier *barrier) {
+#ifdef __riscv_atomic
+    int hartid = __metal_myhart_id();
+
+    if (hartid >= __METAL_DT_MAX_HARTS) {
+        return -1;
+    }
+
+    int sense = !barrier->_hart[hartid]._sense;
+    barrier->_hart[hartid]._sense = sense;
+
+    /* Make this hart's accesses visible before it is counted */
+    __asm__ volatile("fence rw, rw" ::: "memory");
+
+    if (metal_atomic_add(&barrier->_count, 1) == barrier->_harts - 1) {
+        /* The last hart resets the count for the next round and releases
+         * the others */
+        barrier->_count = 0;
+        __asm__ volatile("fence rw, w" ::: "memory");
+        barrier->_sense = sense;
+        __asm__ volatile("fence rw, rw" ::: "memory");
+
+        for (int i = 0; i < __METAL_DT_MAX_HARTS; i++) {
+            if (barrier->_hart[i]._asleep) {
+                metal_cpu_software_set_ipi(metal_cpu_get(i), i);
+            }
+        }
+        return 1;
+    }
+
+    for (int i = 0; i < METAL_HART_BARRIER_SPIN; i++) {
+        if (barrier->_sense == sense) {
+            __asm__ volatile("fence r, rw" ::: "memory");
+            return 0;
+        }
+    }
+
+    __metal_hart_barrier_sleep(barrier, hartid, sense);
+    __asm__ volatile("fence r, rw" ::: "memory");
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,135 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/boot_log.h>
+
+#ifdef METAL_BOOT_LOG
+
+#include <metal/atomic.h>
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/time.h>
+#include <stdio.h>
+
+static const char *const __metal_boot_log_names[] = {
+    [METAL_BOOT_LOG_ENTER] = "enter",
+    [METAL_BOOT_LOG_SCRUB] = "scrub",
+    [METAL_BOOT_LOG_DATA] = "data",
+    [METAL_BOOT_LOG_ITIM] = "itim",
+    [METAL_BOOT_LOG_BSS] = "bss",
+    [METAL_BOOT_LOG_LIBC_INIT] = "libc init",
+    [METAL_BOOT_LOG_CONSTRUCTOR] = "constructor",
+    [METAL_BOOT_LOG_SYNC_HARTS] = "sync harts",
+    [METAL_BOOT_LOG_MAIN] = "main",
+};
+
+static struct metal_boot_log_entry __metal_boot_log[METAL_BOOT_LOG_ENTRIES];
+
+/* The number of entries claimed, which keeps counting once the log is full */
+static metal_atomic_t __metal_boot_log_next;
+
+static void __metal_boot_log_add(unsigned long long cycle, int event,
+                                 void *arg) {
+    int index;
+
+#ifdef __riscv_atomic
+    index = metal_atomic_add(&__metal_boot_log_next, 1);
+#else
+    index = __metal_boot_log_next++;
+#endif
+    if (index >= METAL_BOOT_LOG_ENTRIES) {
+        return;
+    }
+
+    __metal_boot_log[index].cycle = cycle;
+    __metal_boot_log[index].event = event;
+    __metal_boot_log[index].hartid = __metal_myhart_id();
+    __metal_boot_log[index].arg = arg;
+}
+
+/* Called by crt0 once the BSS segment is zeroed, with the low word of mcycle
+ * at the end of each of the earlier phases. The full timestamps are rebuilt
+ * from the current value of mcycle, which is always less than 2^XLEN cycles
+ * later. */
+void __metal_boot_log_early(unsigned long enter, unsigned long scrub,
+                            unsigned long data, unsigned long itim,
+                            unsigned long bss) {
+    unsigned long long now = metal_deadline_now();
+    unsigned long now_lo = now;
+
+    __metal_boot_log_add(now - (unsigned long)(now_lo - enter),
+                         METAL_BOOT_LOG_ENTER, NULL);
+    __metal_boot_log_add(now - (unsigned long)(now_lo - scrub),
+                         METAL_BOOT_LOG_SCRUB, NULL);
+    __metal_boot_log_add(now - (unsigned long)(now_lo - data),
+                         METAL_BOOT_LOG_DATA, NULL);
+    __metal_boot_log_add(now - (unsigned long)(now_lo - itim),
+                         METAL_BOOT_LOG_ITIM, NULL);
+    __metal_boot_log_add(now - (unsigned long)(now_lo - bss),
+                         METAL_BOOT_LOG_BSS, NULL);
+}
+
+void metal_boot_log_record(int event, void *arg) {
+    __metal_boot_log_add(metal_deadline_now(), event, arg);
+}
+
+int metal_boot_log_count(void) {
+    int count = __metal_boot_log_next;
+
+    return (count < METAL_BOOT_LOG_ENTRIES) ? count : METAL_BOOT_LOG_ENTRIES;
+}
+
+int metal_boot_log_get(int index, struct metal_boot_log_entry *entry) {
+    if ((index < 0) || (index >= metal_boot_log_count())) {
+        return -1;
+    }
+    *entry = __metal_boot_log[index];
+    return 0;
+}
+
+void metal_boot_log_dump(void) {
+    int count = metal_boot_log_count();
+
+    for (int i = 0; i < count; i++) {
+        struct metal_boot_log_entry *entry = &__metal_boot_log[i];
+        unsigned long long delta = 0;
+
+        /* Find the previous entry of the same hart */
+        for (int j = i - 1; j >= 0; j--) {
+            if (__metal_boot_log[j].hartid == entry->hartid) {
+                delta = entry->cycle - __metal_boot_log[j].cycle;
+                break;
+            }
+        }
+
+        if ((entry->event >= 0) && (entry->event < METAL_BOOT_LOG_USER)) {
+            printf("hart %d %-12s", entry->hartid,
+                   __metal_boot_log_names[entry->event]);
+        } else {
+            printf("hart %d user %-7d", entry->hartid,
+                   entry->event - METAL_BOOT_LOG_USER);
+        }
+        printf(" %llu (+%llu)", entry->cycle, delta);
+        if (entry->arg) {
+            printf(" %p", entry->arg);
+        }
+        printf("\n");
+    }
+    if (__metal_boot_log_next > METAL_BOOT_LOG_ENTRIES) {
+        printf("%d entries dropped\n",
+               (int)__metal_boot_log_next - METAL_BOOT_LOG_ENTRIES);
+    }
+}
+
+#else /* METAL_BOOT_LOG */
+
+void metal_boot_log_record(int event, void *arg) {}
+
+int metal_boot_log_count(void) { return 0; }
+
+int metal_boot_log_get(int index, struct metal_boot_log_entry *entry) {
+    return -1;
+}
+
+void metal_boot_log_dump(void) {}
+
+#endif /* METAL_BOOT_LOG */
@@ -2,113 +2,156 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
 #include <metal/cache.h>
+#include <metal/cpu.h>
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/io.h>
 #include <metal/machine.h>
 
 extern __inline__ void metal_cache_init(struct metal_cache *cache, int ways);
 extern __inline__ int metal_cache_get_enabled_ways(struct metal_cache *cache);
 extern __inline__ int metal_cache_set_enabled_ways(struct metal_cache *cache,
                                                    int ways);
+extern __inline__ int
+metal_cache_get_geometry(struct metal_cache *cache,
+                         struct metal_cache_geometry *geometry);
+extern __inline__ uint64_t metal_cache_get_way_mask(struct metal_cache *cache,
+                                                    int master);
+extern __inline__ int metal_cache_set_way_mask(struct metal_cache *cache,
+                                               int master, uint64_t mask);
+extern __inline__ void metal_cache_flush_range(struct metal_cache *cache,
+                                               uintptr_t start, size_t len);
 
-int metal_dcache_l1_available(int hartid) {
-    switch (hartid) {
-    case 0:
+/* Geometry of the L1 caches, from the d-cache-* and i-cache-* devicetree
+ * properties. The geometry queries fail when the machine header doesn't
+ * provide them. */
+#if defined(__METAL_DCACHE_L1_LINE_SIZE) && defined(__METAL_DCACHE_L1_SIZE) && \
+    defined(__METAL_DCACHE_L1_WAYS)
+#define __METAL_DCACHE_L1_GEOMETRY
+#endif
+#if defined(__METAL_ICACHE_L1_LINE_SIZE) && defined(__METAL_ICACHE_L1_SIZE) && \
+    defined(__METAL_ICACHE_L1_WAYS)
+#define __METAL_ICACHE_L1_GEOMETRY
+#endif
+
+/* The range operations step through the dcache by line. Stepping by less
+ * than a line only repeats work, so without the line size they use the
+ * smallest line of any SiFive core. */
+#ifdef __METAL_DCACHE_L1_LINE_SIZE
+#define __METAL_DCACHE_L1_STEP __METAL_DCACHE_L1_LINE_SIZE
+#else
+#define __METAL_DCACHE_L1_STEP 32
+#endif
+
+/* Which harts have L1 caches, indexed by hartid */
+static const struct {
+    char dcache;
+    char icache;
+} __metal_cache_l1[__METAL_DT_MAX_HARTS] = {
 #ifdef __METAL_CPU_0_DCACHE_HANDLE
-        return __METAL_CPU_0_DCACHE_HANDLE;
+    [0].dcache = __METAL_CPU_0_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_0_ICACHE_HANDLE
+    [0].icache = __METAL_CPU_0_ICACHE_HANDLE,
 #endif
-        break;
-    case 1:
 #ifdef __METAL_CPU_1_DCACHE_HANDLE
-        return __METAL_CPU_1_DCACHE_HANDLE;
+    [1].dcache = __METAL_CPU_1_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_1_ICACHE_HANDLE
+    [1].icache = __METAL_CPU_1_ICACHE_HANDLE,
 #endif
-        break;
-    case 2:
 #ifdef __METAL_CPU_2_DCACHE_HANDLE
-        return __METAL_CPU_2_DCACHE_HANDLE;
+    [2].dcache = __METAL_CPU_2_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_2_ICACHE_HANDLE
+    [2].icache = __METAL_CPU_2_ICACHE_HANDLE,
 #endif
-        break;
-    case 3:
 #ifdef __METAL_CPU_3_DCACHE_HANDLE
-        return __METAL_CPU_3_DCACHE_HANDLE;
+    [3].dcache = __METAL_CPU_3_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_3_ICACHE_HANDLE
+    [3].icache = __METAL_CPU_3_ICACHE_HANDLE,
 #endif
-        break;
-    case 4:
 #ifdef __METAL_CPU_4_DCACHE_HANDLE
-        return __METAL_CPU_4_DCACHE_HANDLE;
+    [4].dcache = __METAL_CPU_4_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_4_ICACHE_HANDLE
+    [4].icache = __METAL_CPU_4_ICACHE_HANDLE,
 #endif
-        break;
-    case 5:
 #ifdef __METAL_CPU_5_DCACHE_HANDLE
-        return __METAL_CPU_5_DCACHE_HANDLE;
+    [5].dcache = __METAL_CPU_5_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_5_ICACHE_HANDLE
+    [5].icache = __METAL_CPU_5_ICACHE_HANDLE,
 #endif
-        break;
-    case 6:
 #ifdef __METAL_CPU_6_DCACHE_HANDLE
-        return __METAL_CPU_6_DCACHE_HANDLE;
+    [6].dcache = __METAL_CPU_6_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_6_ICACHE_HANDLE
+    [6].icache = __METAL_CPU_6_ICACHE_HANDLE,
 #endif
-        break;
-    case 7:
 #ifdef __METAL_CPU_7_DCACHE_HANDLE
-        return __METAL_CPU_7_DCACHE_HANDLE;
+    [7].dcache = __METAL_CPU_7_DCACHE_HANDLE,
+#endif
+#ifdef __METAL_CPU_7_ICACHE_HANDLE
+    [7].icache = __METAL_CPU_7_ICACHE_HANDLE,
 #endif
-        break;
-    case 8:
 #ifdef __METAL_CPU_8_DCACHE_HANDLE
-        return __METAL_CPU_8_DCACHE_HANDLE;
+    [8].dcache = __METAL_CPU_8_DCACHE_HANDLE,
 #endif
-        break;
+#ifdef __METAL_CPU_8_ICACHE_HANDLE
+    [8].icache = __METAL_CPU_8_ICACHE_HANDLE,
+#endif
+};
+
+static void __metal_cache_l1_geometry(struct metal_cache_geometry *geometry,
+                                      unsigned int line_size, size_t size,
+                                      unsigned int ways) {
+    geometry->line_size = line_size;
+    geometry->ways = ways;
+    geometry->sets = size / (ways * line_size);
+    geometry->size = size;
+}
+
+int metal_dcache_l1_available(int hartid) {
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return 0;
+    }
+    return __metal_cache_l1[hartid].dcache;
+}
+
+int metal_dcache_l1_get_geometry(int hartid,
+                                 struct metal_cache_geometry *geometry) {
+#ifdef __METAL_DCACHE_L1_GEOMETRY
+    if (!metal_dcache_l1_available(hartid)) {
+        return -1;
     }
+    __metal_cache_l1_geometry(geometry, __METAL_DCACHE_L1_LINE_SIZE,
+                              __METAL_DCACHE_L1_SIZE, __METAL_DCACHE_L1_WAYS);
     return 0;
+#else
+    return -1;
+#endif
 }
 
 int metal_icache_l1_available(int hartid) {
-    switch (hartid) {
-    case 0:
-#ifdef __METAL_CPU_0_ICACHE_HANDLE
-        return __METAL_CPU_0_ICACHE_HANDLE;
-#endif
-        break;
-    case 1:
-#ifdef __METAL_CPU_1_ICACHE_HANDLE
-        return __METAL_CPU_1_ICACHE_HANDLE;
-#endif
-        break;
-    case 2:
-#ifdef __METAL_CPU_2_ICACHE_HANDLE
-        return __METAL_CPU_2_ICACHE_HANDLE;
-#endif
-        break;
-    case 3:
-#ifdef __METAL_CPU_3_ICACHE_HANDLE
-        return __METAL_CPU_3_ICACHE_HANDLE;
-#endif
-        break;
-    case 4:
-#ifdef __METAL_CPU_4_ICACHE_HANDLE
-        return __METAL_CPU_4_ICACHE_HANDLE;
-#endif
-        break;
-    case 5:
-#ifdef __METAL_CPU_5_ICACHE_HANDLE
-        return __METAL_CPU_5_ICACHE_HANDLE;
-#endif
-        break;
-    case 6:
-#ifdef __METAL_CPU_6_ICACHE_HANDLE
-        return __METAL_CPU_6_ICACHE_HANDLE;
-#endif
-        break;
-    case 7:
-#ifdef __METAL_CPU_7_ICACHE_HANDLE
-        return __METAL_CPU_7_ICACHE_HANDLE;
-#endif
-        break;
-    case 8:
-#ifdef __METAL_CPU_8_ICACHE_HANDLE
-        return __METAL_CPU_8_ICACHE_HANDLE;
-#endif
-        break;
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return 0;
+    }
+    return __metal_cache_l1[hartid].icache;
+}
+
+int metal_icache_l1_get_geometry(int hartid,
+                                 struct metal_cache_geometry *geometry) {
+#ifdef __METAL_ICACHE_L1_GEOMETRY
+    if (!metal_icache_l1_available(hartid)) {
+        return -1;
     }
+    __metal_cache_l1_geometry(geometry, __METAL_ICACHE_L1_LINE_SIZE,
+                              __METAL_ICACHE_L1_SIZE, __METAL_ICACHE_L1_WAYS);
     return 0;
+#else
+    return -1;
+#endif
 }
 
 /*!
@@ -188,3 +231,162 @@ void metal_dcache_l1_discard(int hartid, uintptr_t address) {
         }
     }
 }
+
+/* Apply the CFLUSH.D.L1 or CDISCARD.D.L1 instruction with immediate imm to
+ * every line in [addr, end). mtvec is redirected once around the whole loop
+ * with interrupts disabled, so that only a fault on a line can trap. A line
+ * which faults is skipped and the loop carries on with the next one. mepc
+ * and mstatus are restored afterwards, since a trap overwrites them and the
+ * caller may be an interrupt handler. */
+#define __METAL_DCACHE_L1_RANGE(imm, addr, end)                                \
+    do {                                                                       \
+        uintptr_t __step = __METAL_DCACHE_L1_STEP;                             \
+        uintptr_t __mtvec, __tmp, __mstatus, __mepc;                           \
+        __asm__ __volatile__("csrrc %2, mstatus, %7 \n\t"                      \
+                             "csrr %3, mepc \n\t"                              \
+                             "csrr %0, mtvec \n\t"                             \
+                             "la %1, 3f \n\t"                                  \
+                             "csrw mtvec, %1 \n\t"                             \
+                             "1: \n\t"                                         \
+                             ".insn i 0x73, 0, x0, %4, " #imm " \n\t"          \
+                             "2: \n\t"                                         \
+                             "add %4, %4, %6 \n\t"                             \
+                             "bltu %4, %5, 1b \n\t"                            \
+                             "j 4f \n\t"                                       \
+                             ".align 2\n\t"                                    \
+                             "3: \n\t"                                         \
+                             "j 2b \n\t"                                       \
+                             "4: \n\t"                                         \
+                             "csrw mtvec, %0 \n\t"                             \
+                             "csrw mepc, %3 \n\t"                              \
+                             "csrw mstatus, %2 \n\t"                           \
+                             : "=&r"(__mtvec), "=&r"(__tmp),                   \
+                               "=&r"(__mstatus), "=&r"(__mepc), "+r"(addr)     \
+                             : "r"(end), "r"(__step), "r"(METAL_MSTATUS_MIE)   \
+                             : "memory");                                      \
+    } while (0)
+
+void metal_dcache_l1_flush_range(uintptr_t start, size_t len) {
+    uintptr_t addr = start & ~((uintptr_t)__METAL_DCACHE_L1_STEP - 1);
+    uintptr_t end = start + len;
+
+    if ((len == 0) ||
+        !metal_dcache_l1_available(metal_cpu_get_current_hartid())) {
+        return;
+    }
+
+#ifdef __METAL_DCACHE_L1_SIZE
+    if (len >= __METAL_DCACHE_L1_SIZE) {
+        __asm__ __volatile__(".word 0xfc000073" : : : "memory");
+        return;
+    }
+#endif
+
+    __METAL_DCACHE_L1_RANGE(-0x40, addr, end);
+}
+
+void metal_dcache_l1_discard_range(uintptr_t start, size_t len) {
+    uintptr_t addr = start & ~((uintptr_t)__METAL_DCACHE_L1_STEP - 1);
+    uintptr_t end = start + len;
+
+    if ((len == 0) ||
+        !metal_dcache_l1_available(metal_cpu_get_current_hartid())) {
+        return;
+    }
+
+    __METAL_DCACHE_L1_RANGE(-0x3E, addr, end);
+}
+
+/* The way mask registers are 64 bits wide and fill the rest of the 4 KiB
+ * control region */
+#define __METAL_CACHE_L2_MASTERS 256
+
+uint64_t __metal_cache_l2_get_way_mask(uintptr_t way_mask, int master) {
+    if ((master < 0) || (master >= __METAL_CACHE_L2_MASTERS)) {
+        return 0;
+    }
+
+    /* Read the halves separately, since RV32 has no 64-bit loads */
+    __metal_io_u32 *reg = (__metal_io_u32 *)(way_mask + (master * 8));
+    uint64_t mask = __METAL_ACCESS_ONCE(&reg[1]);
+    return (mask << 32) | __METAL_ACCESS_ONCE(&reg[0]);
+}
+
+int __metal_cache_l2_set_way_mask(uintptr_t way_mask, int master,
+                                  uint64_t mask, int ways) {
+    uint64_t enabled = (ways >= 64) ? ~0ULL : ((1ULL << ways) - 1);
+
+    /* Each master needs at least one enabled way to allocate into */
+    if ((master < 0) || (master >= __METAL_CACHE_L2_MASTERS) || (mask == 0) ||
+        (mask & ~enabled)) {
+        return -1;
+    }
+
+#if __riscv_xlen >= 64
+    __METAL_ACCESS_ONCE((__metal_io_u64 *)(way_mask + (master * 8))) = mask;
+#else
+    /* The halves are written separately, so first add the new ways and
+     * only then remove the old ones. The master keeps at least the ways of
+     * one of the masks throughout. */
+    __metal_io_u32 *reg = (__metal_io_u32 *)(way_mask + (master * 8));
+    uint64_t both = __metal_cache_l2_get_way_mask(way_mask, master) | mask;
+
+    __METAL_ACCESS_ONCE(&reg[0]) = (uint32_t)both;
+    __METAL_ACCESS_ONCE(&reg[1]) = (uint32_t)(both >> 32);
+    __METAL_ACCESS_ONCE(&reg[0]) = (uint32_t)mask;
+    __METAL_ACCESS_ONCE(&reg[1]) = (uint32_t)(mask >> 32);
+#endif
+
+    return 0;
+}
+
+void __metal_cache_l2_flush_range(uintptr_t flush64, uintptr_t flush32,
+                                  unsigned int line_size, uintptr_t start,
+                                  size_t len) {
+    /* Writing an address to Flush64 writes back and invalidates the line
+     * holding it. Flush32 takes the address shifted right by 4, so it can
+     * be written with a 32-bit store. */
+#if __riscv_xlen >= 64
+    __metal_io_u64 *flush = (__metal_io_u64 *)flush64;
+    const int shift = 0;
+#else
+    __metal_io_u32 *flush = (__metal_io_u32 *)flush32;
+    const int shift = 4;
+#endif
+
+    uintptr_t addr = start & ~((uintptr_t)line_size - 1);
+    for (; addr < start + len; addr += line_size) {
+        __METAL_ACCESS_ONCE(flush) = addr >> shift;
+    }
+}
+
+int metal_cache_lock_range(struct metal_cache *cache, int master,
+                           uint64_t ways, uintptr_t start, size_t len) {
+    struct metal_cache_geometry geometry;
+    uint64_t mask = metal_cache_get_way_mask(cache, master);
+
+    if ((ways == 0) || ((mask & ~ways) == 0) ||
+        (metal_cache_get_geometry(cache, &geometry) != 0)) {
+        return -1;
+    }
+
+    /* Make sure the buffer misses in every cache on the way, so that the
+     * loads below allocate it into the locked ways */
+    metal_dcache_l1_flush_range(start, len);
+    metal_cache_flush_range(cache, start, len);
+
+    /* Give master only the locked ways while it loads the buffer */
+    if (metal_cache_set_way_mask(cache, master, ways) != 0) {
+        return -1;
+    }
+    __asm__ __volatile__("fence rw, rw" : : : "memory");
+
+    uintptr_t addr = start & ~((uintptr_t)geometry.line_size - 1);
+    for (; addr < start + len; addr += geometry.line_size) {
+        (void)*(volatile unsigned char *)addr;
+    }
+
+    /* Wait for the loads to complete before locking the ways */
+    __asm__ __volatile__("fence rw, rw" : : : "memory");
+    return metal_cache_set_way_mask(cache, master, mask & ~ways);
+}
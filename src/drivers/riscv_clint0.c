@@ -9,24 +9,14 @@
 #include <metal/drivers/riscv_clint0.h>
 #include <metal/io.h>
 #include <metal/machine.h>
+#include <metal/timer.h>
 
 unsigned long long
 __metal_clint0_mtime_get(struct __metal_driver_riscv_clint0 *clint) {
-    __metal_io_u32 lo, hi;
     unsigned long control_base =
         __metal_driver_sifive_clint0_control_base(&clint->controller);
 
-    /* Guard against rollover when reading */
-    do {
-        hi = __METAL_ACCESS_ONCE(
-            (__metal_io_u32 *)(control_base + METAL_RISCV_CLINT0_MTIME + 4));
-        lo = __METAL_ACCESS_ONCE(
-            (__metal_io_u32 *)(control_base + METAL_RISCV_CLINT0_MTIME));
-    } while (__METAL_ACCESS_ONCE((__metal_io_u32 *)(control_base +
-                                                    METAL_RISCV_CLINT0_MTIME +
-                                                    4)) != hi);
-
-    return (((unsigned long long)hi) << 32) | lo;
+    return __metal_mtime_read_mmio(control_base + METAL_RISCV_CLINT0_MTIME);
 }
 
 int __metal_driver_riscv_clint0_mtimecmp_set(struct metal_interrupt *controller,
@@ -36,6 +26,12 @@ int __metal_driver_riscv_clint0_mtimecmp_set(struct metal_interrupt *controller,
         (struct __metal_driver_riscv_clint0 *)(controller);
     unsigned long control_base =
         __metal_driver_sifive_clint0_control_base(&clint->controller);
+#if __riscv_xlen == 64
+    /* A single store updates the whole register at once */
+    __METAL_ACCESS_ONCE((__metal_io_u64 *)(control_base + (8 * hartid) +
+                                           METAL_RISCV_CLINT0_MTIMECMP_BASE)) =
+        time;
+#else
     /* Per spec, the RISC-V MTIME/MTIMECMP registers are 64 bit,
      * and are NOT internally latched for multiword transfers.
      * Need to be careful about sequencing to avoid triggering
@@ -51,6 +47,7 @@ int __metal_driver_riscv_clint0_mtimecmp_set(struct metal_interrupt *controller,
     __METAL_ACCESS_ONCE((__metal_io_u32 *)(control_base + (8 * hartid) +
                                            METAL_RISCV_CLINT0_MTIMECMP_BASE +
                                            4)) = (__metal_io_u32)(time >> 32);
+#endif
     return 0;
 }
 
@@ -2,21 +2,47 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
 #include <metal/io.h>
+#include <metal/irq_stats.h>
 #include <metal/machine.h>
+#include <metal/percpu.h>
 #include <metal/shutdown.h>
 #include <stdint.h>
 
 #define __METAL_IRQ_VECTOR_HANDLER(id)                                         \
     void *priv;                                                                \
     struct __metal_driver_riscv_cpu_intc *intc;                                \
-    struct __metal_driver_cpu *cpu = __metal_cpu_table[__metal_myhart_id()];   \
+    struct __metal_driver_cpu *cpu;                                            \
+    __METAL_IRQ_STATS_ENTER();                                                 \
+    cpu = __metal_driver_cpu_self();                                           \
     if (cpu) {                                                                 \
         intc = (struct __metal_driver_riscv_cpu_intc *)                        \
             __metal_driver_cpu_interrupt_controller((struct metal_cpu *)cpu);  \
         priv = intc->metal_int_table[id].exint_data;                           \
-        intc->metal_int_table[id].handler(id, priv);                           \
+        __METAL_IRQ_STATS_DISPATCH(                                            \
+            METAL_IRQ_STATS_CPU, id,                                           \
+            intc->metal_int_table[id].handler(id, priv));                      \
+    }                                                                          \
+    if (__metal_thread_preempt) {                                              \
+        __metal_thread_preempt();                                              \
     }
 
+/* Only linked in when the application uses threads. Switches threads at the
+ * end of an interrupt when the time slice of the running thread is over. */
+void __metal_thread_preempt(void) __attribute__((weak));
+
+/* The driver of the current hart, cached on its first trap */
+static METAL_PERCPU_DEFINE(struct __metal_driver_cpu *, __metal_cpu_self);
+
+static struct __metal_driver_cpu *__metal_driver_cpu_self(void) {
+    struct __metal_driver_cpu *cpu = METAL_PERCPU(__metal_cpu_self);
+
+    if (cpu == NULL) {
+        cpu = __metal_cpu_table[__metal_myhart_id()];
+        METAL_PERCPU(__metal_cpu_self) = cpu;
+    }
+    return cpu;
+}
+
 extern void __metal_vector_table();
 unsigned long long __metal_driver_cpu_mtime_get(struct metal_cpu *cpu);
 int __metal_driver_cpu_mtimecmp_set(struct metal_cpu *cpu,
@@ -129,10 +155,18 @@ metal_software_interrupt_vector_handler(void) {
     __METAL_IRQ_VECTOR_HANDLER(METAL_INTERRUPT_ID_SW);
 }
 
+/* Only linked in when the application uses the hart mailboxes */
+int metal_hart_mailbox_service(void) __attribute__((weak));
+
 void __metal_default_sw_handler(int id, void *priv) {
     uintptr_t mcause;
     struct __metal_driver_riscv_cpu_intc *intc;
-    struct __metal_driver_cpu *cpu = __metal_cpu_table[__metal_myhart_id()];
+    struct __metal_driver_cpu *cpu = __metal_driver_cpu_self();
+
+    /* Deliver any messages sent to this hart with metal_hart_send() */
+    if (metal_hart_mailbox_service && (metal_hart_mailbox_service() >= 0)) {
+        return;
+    }
 
     __asm__ volatile("csrr %0, mcause" : "=r"(mcause));
     if (cpu) {
@@ -151,9 +185,20 @@ metal_timer_interrupt_vector_handler(void) {
 
 void __metal_default_beu_handler(int id, void *priv) {}
 
+/* Only linked in when the application uses software timers */
+int metal_timer_service(void) __attribute__((weak));
+
 void __metal_default_timer_handler(int id, void *priv) {
-    struct metal_cpu *cpu = __metal_driver_cpu_get(__metal_myhart_id());
-    unsigned long long time = __metal_driver_cpu_mtime_get(cpu);
+    struct metal_cpu *cpu;
+    unsigned long long time;
+
+    /* Run the software timers added with metal_timer_add() */
+    if (metal_timer_service && (metal_timer_service() >= 0)) {
+        return;
+    }
+
+    cpu = __metal_driver_cpu_get(__metal_myhart_id());
+    time = __metal_driver_cpu_mtime_get(cpu);
 
     /* Set a 10 cycle timer */
     __metal_driver_cpu_mtimecmp_set(cpu, time + 10);
@@ -171,7 +216,10 @@ void __metal_exception_handler(void) {
     void *priv;
     uintptr_t mcause, mepc, mtval, mtvec;
     struct __metal_driver_riscv_cpu_intc *intc;
-    struct __metal_driver_cpu *cpu = __metal_cpu_table[__metal_myhart_id()];
+    struct __metal_driver_cpu *cpu;
+
+    __METAL_IRQ_STATS_ENTER();
+    cpu = __metal_driver_cpu_self();
 
     __asm__ volatile("csrr %0, mcause" : "=r"(mcause));
     __asm__ volatile("csrr %0, mepc" : "=r"(mepc));
@@ -185,13 +233,20 @@ void __metal_exception_handler(void) {
         if (mcause & METAL_MCAUSE_INTR) {
             if (id == METAL_INTERRUPT_ID_BEU) {
                 priv = intc->metal_int_beu.exint_data;
-                intc->metal_int_beu.handler(id, priv);
+                __METAL_IRQ_STATS_DISPATCH(
+                    METAL_IRQ_STATS_CPU, id,
+                    intc->metal_int_beu.handler(id, priv));
                 return;
             }
             if ((id < METAL_INTERRUPT_ID_CSW) ||
                 ((mtvec & METAL_MTVEC_MASK) == METAL_MTVEC_DIRECT)) {
                 priv = intc->metal_int_table[id].exint_data;
-                intc->metal_int_table[id].handler(id, priv);
+                __METAL_IRQ_STATS_DISPATCH(
+                    METAL_IRQ_STATS_CPU, id,
+                    intc->metal_int_table[id].handler(id, priv));
+                if (__metal_thread_preempt) {
+                    __metal_thread_preempt();
+                }
                 return;
             }
             if ((mtvec & METAL_MTVEC_MASK) == METAL_MTVEC_CLIC) {
@@ -201,7 +256,8 @@ void __metal_exception_handler(void) {
                 __asm__ volatile("csrr %0, 0x307" : "=r"(mtvt));
                 priv = intc->metal_int_table[METAL_INTERRUPT_ID_SW].sub_int;
                 mtvt_handler = (metal_interrupt_handler_t) * (uintptr_t *)mtvt;
-                mtvt_handler(id, priv);
+                __METAL_IRQ_STATS_DISPATCH(METAL_IRQ_STATS_CPU, id,
+                                           mtvt_handler(id, priv));
                 return;
             }
         } else {
@@ -10,28 +10,19 @@
 #include <metal/drivers/riscv_plic0.h>
 #include <metal/interrupt.h>
 #include <metal/io.h>
+#include <metal/irq_stats.h>
 #include <metal/machine.h>
 #include <metal/shutdown.h>
 
-unsigned int
-__metal_plic0_claim_interrupt(struct __metal_driver_riscv_plic0 *plic,
-                              int context_id) {
+__metal_io_u32 *
+__metal_plic0_claim_register(struct __metal_driver_riscv_plic0 *plic,
+                             int context_id) {
     unsigned long control_base = __metal_driver_sifive_plic0_control_base(
         (struct metal_interrupt *)plic);
-    return __METAL_ACCESS_ONCE(
-        (__metal_io_u32 *)(control_base + METAL_RISCV_PLIC0_CONTEXT_BASE +
-                           (context_id * METAL_RISCV_PLIC0_CONTEXT_PER_HART) +
-                           METAL_RISCV_PLIC0_CONTEXT_CLAIM));
-}
-
-void __metal_plic0_complete_interrupt(struct __metal_driver_riscv_plic0 *plic,
-                                      int context_id, unsigned int id) {
-    unsigned long control_base = __metal_driver_sifive_plic0_control_base(
-        (struct metal_interrupt *)plic);
-    __METAL_ACCESS_ONCE(
-        (__metal_io_u32 *)(control_base + METAL_RISCV_PLIC0_CONTEXT_BASE +
-                           (context_id * METAL_RISCV_PLIC0_CONTEXT_PER_HART) +
-                           METAL_RISCV_PLIC0_CONTEXT_CLAIM)) = id;
+    return (__metal_io_u32 *)(
+        control_base + METAL_RISCV_PLIC0_CONTEXT_BASE +
+        (context_id * METAL_RISCV_PLIC0_CONTEXT_PER_HART) +
+        METAL_RISCV_PLIC0_CONTEXT_CLAIM);
 }
 
 int __metal_plic0_set_threshold(struct metal_interrupt *controller,
@@ -106,18 +97,23 @@ void __metal_plic0_default_handler(int id, void *priv) { metal_shutdown(300); }
 
 void __metal_plic0_handler(int id, void *priv) {
     struct __metal_driver_riscv_plic0 *plic = priv;
-    int contextid =
-        __metal_driver_sifive_plic0_context_ids(__metal_myhart_id());
-    unsigned int idx = __metal_plic0_claim_interrupt(plic, contextid);
-    unsigned int num_interrupts = __metal_driver_sifive_plic0_num_interrupts(
-        (struct metal_interrupt *)plic);
-
-    if ((idx < num_interrupts) && (plic->metal_exint_table[idx])) {
-        plic->metal_exint_table[idx](idx,
-                                     plic->metal_exdata_table[idx].exint_data);
+    __metal_io_u32 *claim = plic->claim_table[__metal_myhart_id()];
+    struct __metal_plic0_dispatch *entry;
+    unsigned int idx;
+
+    /* Keep claiming until nothing is left pending for this hart, so that
+     * interrupts raised back to back are taken without another trap */
+    while ((idx = __METAL_ACCESS_ONCE(claim)) != 0) {
+        if (idx < __METAL_PLIC_SUBINTERRUPTS) {
+            entry = &plic->metal_exint_table[idx];
+            if (entry->handler) {
+                __METAL_IRQ_STATS_DISPATCH(
+                    METAL_IRQ_STATS_PLIC, idx,
+                    entry->handler(idx, entry->exint_data));
+            }
+        }
+        __METAL_ACCESS_ONCE(claim) = idx;
     }
-
-    __metal_plic0_complete_interrupt(plic, contextid, idx);
 }
 
 void __metal_driver_riscv_plic0_init(struct metal_interrupt *controller) {
@@ -142,9 +138,8 @@ void __metal_driver_riscv_plic0_init(struct metal_interrupt *controller) {
                 __metal_plic0_enable(plic, parent, i, METAL_DISABLE);
                 if (i < num_interrupts) {
                     __metal_driver_riscv_plic0_set_priority(controller, i, 0);
-                    plic->metal_exint_table[i] = NULL;
-                    plic->metal_exdata_table[i].sub_int = NULL;
-                    plic->metal_exdata_table[i].exint_data = NULL;
+                    plic->metal_exint_table[i].handler = NULL;
+                    plic->metal_exint_table[i].exint_data = NULL;
                 }
             }
 
@@ -158,6 +153,12 @@ void __metal_driver_riscv_plic0_init(struct metal_interrupt *controller) {
             /* Enable plic (ext) interrupt with with parent controller */
             intc->vtable->interrupt_enable(intc, line);
         }
+
+        /* Resolve each hart's claim register once, ahead of the handler */
+        for (int hart = 0; hart < __METAL_DT_MAX_HARTS; hart++) {
+            plic->claim_table[hart] = __metal_plic0_claim_register(
+                plic, __metal_driver_sifive_plic0_context_ids(hart));
+        }
         plic->init_done = 1;
     }
 }
@@ -173,12 +174,12 @@ int __metal_driver_riscv_plic0_register(struct metal_interrupt *controller,
 
     if (isr) {
         __metal_driver_riscv_plic0_set_priority(controller, id, 2);
-        plic->metal_exint_table[id] = isr;
-        plic->metal_exdata_table[id].exint_data = priv;
+        plic->metal_exint_table[id].handler = isr;
+        plic->metal_exint_table[id].exint_data = priv;
     } else {
         __metal_driver_riscv_plic0_set_priority(controller, id, 1);
-        plic->metal_exint_table[id] = __metal_plic0_default_handler;
-        plic->metal_exdata_table[id].sub_int = priv;
+        plic->metal_exint_table[id].handler = __metal_plic0_default_handler;
+        plic->metal_exint_table[id].exint_data = priv;
     }
 
     return 0;
@@ -11,8 +11,25 @@
 #include <metal/machine.h>
 #include <stdint.h>
 
+#define L2_CONFIG_BANKS_SHIFT 0
+#define L2_CONFIG_BANKS_MASK (0xFF << L2_CONFIG_BANKS_SHIFT)
 #define L2_CONFIG_WAYS_SHIFT 8
 #define L2_CONFIG_WAYS_MASK (0xFF << L2_CONFIG_WAYS_SHIFT)
+#define L2_CONFIG_LG_SETS_SHIFT 16
+#define L2_CONFIG_LG_SETS_MASK (0xFF << L2_CONFIG_LG_SETS_SHIFT)
+#define L2_CONFIG_LG_BLOCK_SHIFT 24
+#define L2_CONFIG_LG_BLOCK_MASK (0xFF << L2_CONFIG_LG_BLOCK_SHIFT)
+
+/* Register offsets which older machine headers don't provide */
+#ifndef METAL_SIFIVE_CCACHE0_FLUSH64
+#define METAL_SIFIVE_CCACHE0_FLUSH64 512UL
+#endif
+#ifndef METAL_SIFIVE_CCACHE0_FLUSH32
+#define METAL_SIFIVE_CCACHE0_FLUSH32 576UL
+#endif
+#ifndef METAL_SIFIVE_CCACHE0_WAYMASK0
+#define METAL_SIFIVE_CCACHE0_WAYMASK0 2048UL
+#endif
 
 void __metal_driver_sifive_ccache0_init(struct metal_cache *l2, int ways);
 
@@ -76,10 +93,74 @@ int __metal_driver_sifive_ccache0_set_enabled_ways(struct metal_cache *cache,
     return 0;
 }
 
+int __metal_driver_sifive_ccache0_get_geometry(
+    struct metal_cache *cache, struct metal_cache_geometry *geometry) {
+    unsigned long control_base =
+        __metal_driver_sifive_ccache0_control_base(cache);
+
+    /* The geometry is described by the config register */
+    uint32_t config = __METAL_ACCESS_ONCE(
+        (__metal_io_u32 *)(control_base + METAL_SIFIVE_CCACHE0_CONFIG));
+    unsigned int banks =
+        (config & L2_CONFIG_BANKS_MASK) >> L2_CONFIG_BANKS_SHIFT;
+    unsigned int lg_sets =
+        (config & L2_CONFIG_LG_SETS_MASK) >> L2_CONFIG_LG_SETS_SHIFT;
+    unsigned int lg_block =
+        (config & L2_CONFIG_LG_BLOCK_MASK) >> L2_CONFIG_LG_BLOCK_SHIFT;
+
+    geometry->line_size = 1 << lg_block;
+    geometry->sets = banks << lg_sets;
+    geometry->ways = (config & L2_CONFIG_WAYS_MASK) >> L2_CONFIG_WAYS_SHIFT;
+    geometry->size =
+        (size_t)geometry->sets * geometry->ways * geometry->line_size;
+
+    return 0;
+}
+
+uint64_t __metal_driver_sifive_ccache0_get_way_mask(struct metal_cache *cache,
+                                                    int master) {
+    unsigned long control_base =
+        __metal_driver_sifive_ccache0_control_base(cache);
+
+    return __metal_cache_l2_get_way_mask(
+        control_base + METAL_SIFIVE_CCACHE0_WAYMASK0, master);
+}
+
+int __metal_driver_sifive_ccache0_set_way_mask(struct metal_cache *cache,
+                                               int master, uint64_t mask) {
+    unsigned long control_base =
+        __metal_driver_sifive_ccache0_control_base(cache);
+
+    return __metal_cache_l2_set_way_mask(
+        control_base + METAL_SIFIVE_CCACHE0_WAYMASK0, master, mask,
+        metal_cache_get_enabled_ways(cache));
+}
+
+void __metal_driver_sifive_ccache0_flush_range(struct metal_cache *cache,
+                                               uintptr_t start, size_t len) {
+    unsigned long control_base =
+        __metal_driver_sifive_ccache0_control_base(cache);
+    struct metal_cache_geometry geometry;
+
+    if (len == 0) {
+        return;
+    }
+    metal_cache_get_geometry(cache, &geometry);
+
+    __metal_cache_l2_flush_range(
+        control_base + METAL_SIFIVE_CCACHE0_FLUSH64,
+        control_base + METAL_SIFIVE_CCACHE0_FLUSH32, geometry.line_size,
+        start, len);
+}
+
 __METAL_DEFINE_VTABLE(__metal_driver_vtable_sifive_ccache0) = {
     .cache.init = __metal_driver_sifive_ccache0_init,
     .cache.get_enabled_ways = __metal_driver_sifive_ccache0_get_enabled_ways,
     .cache.set_enabled_ways = __metal_driver_sifive_ccache0_set_enabled_ways,
+    .cache.get_geometry = __metal_driver_sifive_ccache0_get_geometry,
+    .cache.get_way_mask = __metal_driver_sifive_ccache0_get_way_mask,
+    .cache.set_way_mask = __metal_driver_sifive_ccache0_set_way_mask,
+    .cache.flush_range = __metal_driver_sifive_ccache0_flush_range,
 };
 
 #endif
@@ -7,8 +7,10 @@
 
 #include <metal/drivers/sifive_clic0.h>
 #include <metal/io.h>
+#include <metal/irq_stats.h>
 #include <metal/machine.h>
 #include <metal/shutdown.h>
+#include <metal/timer.h>
 #include <stdint.h>
 
 #define CLIC0_MAX_INTERRUPTS 4096
@@ -403,21 +405,10 @@ int __metal_clic0_configure_get_level(
 
 unsigned long long
 __metal_clic0_mtime_get(struct __metal_driver_sifive_clic0 *clic) {
-    __metal_io_u32 lo, hi;
     unsigned long control_base = __metal_driver_sifive_clic0_control_base(
         (struct metal_interrupt *)clic);
 
-    /* Guard against rollover when reading */
-    do {
-        hi = __METAL_ACCESS_ONCE(
-            (__metal_io_u32 *)(control_base + METAL_SIFIVE_CLIC0_MTIME + 4));
-        lo = __METAL_ACCESS_ONCE(
-            (__metal_io_u32 *)(control_base + METAL_SIFIVE_CLIC0_MTIME));
-    } while (__METAL_ACCESS_ONCE((__metal_io_u32 *)(control_base +
-                                                    METAL_SIFIVE_CLIC0_MTIME +
-                                                    4)) != hi);
-
-    return (((unsigned long long)hi) << 32) | lo;
+    return __metal_mtime_read_mmio(control_base + METAL_SIFIVE_CLIC0_MTIME);
 }
 
 int __metal_driver_sifive_clic0_mtimecmp_set(struct metal_interrupt *controller,
@@ -428,6 +419,12 @@ int __metal_driver_sifive_clic0_mtimecmp_set(struct metal_interrupt *controller,
 
     unsigned long control_base = __metal_driver_sifive_clic0_control_base(
         (struct metal_interrupt *)clic);
+#if __riscv_xlen == 64
+    /* A single store updates the whole register at once */
+    __METAL_ACCESS_ONCE((__metal_io_u64 *)(control_base + (8 * hartid) +
+                                           METAL_SIFIVE_CLIC0_MTIMECMP_BASE)) =
+        time;
+#else
     /* Per spec, the RISC-V MTIME/MTIMECMP registers are 64 bit,
      * and are NOT internally latched for multiword transfers.
      * Need to be careful about sequencing to avoid triggering
@@ -443,6 +440,7 @@ int __metal_driver_sifive_clic0_mtimecmp_set(struct metal_interrupt *controller,
     __METAL_ACCESS_ONCE((__metal_io_u32 *)(control_base + (8 * hartid) +
                                            METAL_SIFIVE_CLIC0_MTIMECMP_BASE +
                                            4)) = (__metal_io_u32)(time >> 32);
+#endif
     return 0;
 }
 
@@ -452,8 +450,10 @@ void __metal_clic0_handler(int id, void *priv) {
         (struct metal_interrupt *)clic);
 
     if ((id < num_subinterrupts) && (clic->metal_exint_table[id].handler)) {
-        clic->metal_exint_table[id].handler(
-            id, clic->metal_exint_table[id].exint_data);
+        __METAL_IRQ_STATS_DISPATCH(
+            METAL_IRQ_STATS_CLIC, id,
+            clic->metal_exint_table[id].handler(
+                id, clic->metal_exint_table[id].exint_data));
     }
 }
 
@@ -40,11 +40,12 @@
     (__METAL_ACCESS_ONCE((__metal_io_u32 *)METAL_I2C_REG(offset)))
 
 /* Timeout macros for register status checks */
-#define METAL_I2C_RXDATA_TIMEOUT 1
-#define METAL_I2C_TIMEOUT_RESET(timeout)                                       \
-    timeout = metal_time() + METAL_I2C_RXDATA_TIMEOUT
+#define METAL_I2C_RXDATA_TIMEOUT_US 1000000
+#define METAL_I2C_TIMEOUT_INIT(timeout)                                        \
+    metal_deadline_init_us(&(timeout), METAL_I2C_RXDATA_TIMEOUT_US)
+#define METAL_I2C_TIMEOUT_RESET(timeout) metal_deadline_rearm(&(timeout))
 #define METAL_I2C_TIMEOUT_CHECK(timeout)                                       \
-    if (metal_time() > timeout) {                                              \
+    if (metal_deadline_expired(&(timeout))) {                                  \
         METAL_I2C_LOG("I2C timeout error.\n");                                 \
         return METAL_I2C_RET_ERR;                                              \
     }
@@ -169,10 +170,10 @@ static int __metal_driver_sifive_i2c0_set_baud_rate(struct metal_i2c *gi2c,
 static int __metal_driver_sifive_i2c0_write_addr(unsigned long base,
                                                  unsigned int addr,
                                                  unsigned char rw_flag) {
-    time_t timeout;
+    struct metal_deadline timeout;
     int ret = METAL_I2C_RET_OK;
-    /* Reset timeout */
-    METAL_I2C_TIMEOUT_RESET(timeout);
+    /* Arm timeout */
+    METAL_I2C_TIMEOUT_INIT(timeout);
 
     /* Check if any transfer is in progress */
     METAL_I2C_REG_CHECK(
@@ -209,11 +210,13 @@ static int __metal_driver_sifive_i2c0_write(struct metal_i2c *i2c,
                                             unsigned char buf[],
                                             metal_i2c_stop_bit_t stop_bit) {
     __metal_io_u8 command;
-    time_t timeout;
+    struct metal_deadline timeout;
     int ret;
     unsigned long base = __metal_driver_sifive_i2c0_control_base(i2c);
     unsigned int i;
 
+    METAL_I2C_TIMEOUT_INIT(timeout);
+
     if ((i2c != NULL) &&
         ((struct __metal_driver_sifive_i2c0 *)i2c)->init_done) {
 
@@ -273,10 +276,12 @@ static int __metal_driver_sifive_i2c0_read(struct metal_i2c *i2c,
                                            metal_i2c_stop_bit_t stop_bit) {
     int ret;
     __metal_io_u8 command;
-    time_t timeout;
+    struct metal_deadline timeout;
     unsigned int i;
     unsigned long base = __metal_driver_sifive_i2c0_control_base(i2c);
 
+    METAL_I2C_TIMEOUT_INIT(timeout);
+
     if ((i2c != NULL) &&
         ((struct __metal_driver_sifive_i2c0 *)i2c)->init_done) {
 
@@ -326,11 +331,13 @@ __metal_driver_sifive_i2c0_transfer(struct metal_i2c *i2c, unsigned int addr,
                                     unsigned char txbuf[], unsigned int txlen,
                                     unsigned char rxbuf[], unsigned int rxlen) {
     __metal_io_u8 command;
-    time_t timeout;
+    struct metal_deadline timeout;
     int ret;
     unsigned int i;
     unsigned long base = __metal_driver_sifive_i2c0_control_base(i2c);
 
+    METAL_I2C_TIMEOUT_INIT(timeout);
+
     if ((i2c != NULL) &&
         ((struct __metal_driver_sifive_i2c0 *)i2c)->init_done) {
         if (txlen) {
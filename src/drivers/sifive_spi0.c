@@ -6,9 +6,10 @@
 #ifdef METAL_SIFIVE_SPI0
 #include <metal/drivers/sifive_spi0.h>
 #include <metal/io.h>
+#include <metal/itim.h>
 #include <metal/machine.h>
 #include <metal/time.h>
-#include <time.h>
+#include <metal/timer.h>
 
 /* Register fields */
 #define METAL_SPI_SCKDIV_MASK 0xFFF
@@ -37,6 +38,8 @@
 #define METAL_SPI_RXDATA_EMPTY (1 << 31)
 #define METAL_SPI_TXMARK_MASK 7
 #define METAL_SPI_TXWM 1
+#define METAL_SPI_RXWM 2
+#define METAL_SPI_RXMARK_MASK 7
 #define METAL_SPI_TXRXDATA_MASK (0xFF)
 
 #define METAL_SPI_INTERVAL_SHIFT 16
@@ -44,13 +47,69 @@
 #define METAL_SPI_CONTROL_IO 0
 #define METAL_SPI_CONTROL_MAPPED 1
 
+#define METAL_SPI_FFMT_CMD_EN 1
+#define METAL_SPI_FFMT_ADDR_LEN_SHIFT 1
+#define METAL_SPI_FFMT_ADDR_LEN_MAX 4
+#define METAL_SPI_FFMT_PAD_CNT_SHIFT 4
+#define METAL_SPI_FFMT_PAD_CNT_MAX 15
+#define METAL_SPI_FFMT_CMD_PROTO_SHIFT 8
+#define METAL_SPI_FFMT_ADDR_PROTO_SHIFT 10
+#define METAL_SPI_FFMT_DATA_PROTO_SHIFT 12
+#define METAL_SPI_FFMT_CMD_CODE_SHIFT 16
+#define METAL_SPI_FFMT_PAD_CODE_SHIFT 24
+
 #define METAL_SPI_REG(offset) (((unsigned long)control_base + offset))
 #define METAL_SPI_REGB(offset)                                                 \
     (__METAL_ACCESS_ONCE((__metal_io_u8 *)METAL_SPI_REG(offset)))
 #define METAL_SPI_REGW(offset)                                                 \
     (__METAL_ACCESS_ONCE((__metal_io_u32 *)METAL_SPI_REG(offset)))
 
-#define METAL_SPI_RXDATA_TIMEOUT 1
+#define METAL_SPI_RXDATA_TIMEOUT_US 1000000
+
+/* Depth of the transmit and receive FIFOs */
+#define METAL_SPI_FIFO_DEPTH 8
+
+/* Transmit watermark used to stream bytes in batches when receive is
+ * disabled */
+#define METAL_SPI_TX_BURST_MARK (METAL_SPI_FIFO_DEPTH / 2)
+
+/* Phases of a transfer, in the order they go out on the bus */
+#define METAL_SPI_PHASE_CMD 0
+#define METAL_SPI_PHASE_ADDR 1
+#define METAL_SPI_PHASE_DUMMY 2
+#define METAL_SPI_PHASE_DATA 3
+#define METAL_SPI_NUM_PHASES 4
+
+/* Switch the flash interface to the given mode and return the mode it was in.
+ * Instructions cannot be fetched from the memory-mapped flash while it is in
+ * programmed I/O mode, so this runs from the ITIM, and the instruction cache
+ * is flushed once the flash is mapped again. */
+static __attribute__((noinline)) METAL_PLACE_IN_ITIM int
+spi_flash_control(long control_base, int mode) {
+    int prev =
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_FCTRL) & METAL_SPI_CONTROL_MAPPED;
+
+    if (prev != mode) {
+        /* Let outstanding flash reads complete before the switch */
+        __METAL_IO_FENCE(iorw, o)
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_FCTRL) = mode;
+        __METAL_IO_FENCE(o, iorw)
+        if (mode == METAL_SPI_CONTROL_MAPPED) {
+            __asm__ volatile("fence.i" ::: "memory");
+        }
+    }
+    return prev;
+}
+
+/* Write the flash read format. Reads which are already in flight use the old
+ * format, so like spi_flash_control() this must not run from the flash. */
+static __attribute__((noinline)) METAL_PLACE_IN_ITIM void
+spi_flash_format(long control_base, unsigned long ffmt) {
+    __METAL_IO_FENCE(iorw, o)
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_FFMT) = ffmt;
+    __METAL_IO_FENCE(o, iorw)
+    __asm__ volatile("fence.i" ::: "memory");
+}
 
 static int configure_spi(struct __metal_driver_sifive_spi0 *spi,
                          struct metal_spi_config *config) {
@@ -125,18 +184,32 @@ static int configure_spi(struct __metal_driver_sifive_spi0 *spi,
     /* Set CS line */
     METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSID) = config->csid;
 
-    /* Toggle off memory-mapped SPI flash mode, toggle on programmable IO mode
-     * It seems that with this line uncommented, the debugger cannot have access
-     * to the chip at all because it assumes the chip is in memory-mapped mode.
-     * I have to compile the code with this line commented and launch gdb,
-     * reset cores, reset $pc, set *((int *) 0x20004060) = 0, (set the flash
-     * interface control register to programmable I/O mode) and then continue
-     * Alternative, comment out the "flash" line in openocd.cfg */
-    METAL_SPI_REGW(METAL_SIFIVE_SPI0_FCTRL) = METAL_SPI_CONTROL_IO;
+    /* Toggle off memory-mapped SPI flash mode, toggle on programmable IO mode.
+     * Leaving the flash unmapped after the transfer keeps the debugger from
+     * accessing the chip, since it assumes the chip is in memory-mapped mode,
+     * so spi_release() switches back to the mode found here. */
+    spi->flash_restore = (spi_flash_control(control_base,
+                                            METAL_SPI_CONTROL_IO) ==
+                          METAL_SPI_CONTROL_MAPPED);
 
     return 0;
 }
 
+/* End a transfer by setting CSMODE back to auto, letting the chip select
+ * transition back to inactive, and remapping the flash if configure_spi()
+ * unmapped it */
+static void spi_release(struct __metal_driver_sifive_spi0 *spi) {
+    long control_base =
+        __metal_driver_sifive_spi0_control_base((struct metal_spi *)spi);
+
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &= ~(METAL_SPI_CSMODE_MASK);
+
+    if (spi->flash_restore) {
+        spi->flash_restore = 0;
+        spi_flash_control(control_base, METAL_SPI_CONTROL_MAPPED);
+    }
+}
+
 static void spi_mode_switch(struct __metal_driver_sifive_spi0 *spi,
                             struct metal_spi_config *config,
                             unsigned int trans_stage) {
@@ -159,6 +232,162 @@ static void spi_mode_switch(struct __metal_driver_sifive_spi0 *spi,
     }
 }
 
+/* Index one past the last byte of a transfer phase */
+static size_t spi_phase_end(struct metal_spi_config *config, size_t len,
+                            int phase) {
+    size_t end = 0;
+
+    switch (phase) {
+    case METAL_SPI_PHASE_DATA:
+        return len;
+    case METAL_SPI_PHASE_DUMMY:
+        end += config->dummy_num;
+        /* fallthrough */
+    case METAL_SPI_PHASE_ADDR:
+        end += config->addr_num;
+        /* fallthrough */
+    case METAL_SPI_PHASE_CMD:
+        end += config->cmd_num;
+    }
+    return __METAL_MIN(end, len);
+}
+
+/* switch to Dual/Quad mode at the start of a phase. Every byte of the previous
+ * phase must have been received, so the new format only applies to this
+ * phase. */
+static void spi_phase_switch(struct __metal_driver_sifive_spi0 *spi,
+                             struct metal_spi_config *config, int phase) {
+    if (phase == METAL_SPI_PHASE_ADDR) {
+        spi_mode_switch(spi, config, MULTI_WIRE_ADDR_DATA);
+    } else if (phase == METAL_SPI_PHASE_DATA) {
+        spi_mode_switch(spi, config, MULTI_WIRE_DATA_ONLY);
+    }
+}
+
+/* Move the bytes [i, end) of a transfer through the FIFOs, keeping up to
+ * METAL_SPI_FIFO_DEPTH bytes in flight. Since no more bytes are in flight than
+ * either FIFO can hold, TXDATA never has to be checked for space and RXDATA
+ * never overflows. Returns once the last byte has been received, or 1 if no
+ * byte arrives before the deadline. */
+static int spi_pipeline(long control_base, size_t i, size_t end, char *tx_buf,
+                        char *rx_buf, struct metal_deadline *endwait) {
+    size_t tx_i = i;
+    size_t rx_i = i;
+    unsigned long rxdata;
+
+    while (rx_i < end) {
+        /* Top up the transmit FIFO */
+        while ((tx_i < end) && (tx_i - rx_i < METAL_SPI_FIFO_DEPTH)) {
+            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) =
+                tx_buf ? tx_buf[tx_i] : 0;
+            tx_i++;
+        }
+
+        /* Drain whatever has arrived so far */
+        if ((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
+            METAL_SPI_RXDATA_EMPTY) {
+            if (metal_deadline_expired(endwait)) {
+                return 1;
+            }
+            continue;
+        }
+        do {
+            if (rx_buf) {
+                rx_buf[rx_i] = (char)(rxdata & METAL_SPI_TXRXDATA_MASK);
+            }
+            rx_i++;
+        } while ((rx_i < tx_i) &&
+                 !((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
+                   METAL_SPI_RXDATA_EMPTY));
+
+        metal_deadline_rearm(endwait);
+    }
+
+    return 0;
+}
+
+/* With the receive FIFO disabled nothing reports when the last frame has
+ * left the shift register, so wait out one single-wire frame: 8 SCK periods
+ * of 2 * (div + 1) peripheral clocks each. The wait is measured on mtime,
+ * scaled by the rate of the peripheral clock, since the core may run faster
+ * than the peripheral clock. Returns 1 if the deadline passes first. */
+static int spi_wait_frame(struct metal_spi *gspi, long control_base,
+                          struct metal_deadline *endwait) {
+    struct metal_clock *clock = __metal_driver_sifive_spi0_clock(gspi);
+    const struct metal_time_scale *scale = metal_time_scale_timebase();
+    unsigned long div =
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_SCKDIV) & METAL_SPI_SCKDIV_MASK;
+    unsigned long long clocks = 8 * 2 * (div + 1);
+    long rate = clock ? metal_clock_get_rate_hz(clock) : 0;
+
+    if ((rate <= 0) || (scale == NULL)) {
+        /* Without the clock rates the frame can't be timed, so wait a
+         * millisecond, which covers a frame at any divider above 65 MHz */
+        struct metal_deadline frame;
+
+        metal_deadline_init_us(&frame, 1000);
+        while (!metal_deadline_expired(&frame))
+            ;
+        return 0;
+    }
+
+    /* Round up, plus one tick for the partial tick at the start */
+    unsigned long long frame_end =
+        metal_mtime_read() + (clocks * scale->hz + rate - 1) / rate + 1;
+    while ((long long)(metal_mtime_read() - frame_end) < 0) {
+        if (metal_deadline_expired(endwait)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Send the bytes [i, end) of a transfer with the receive FIFO disabled. The
+ * transmit watermark tells us when a batch of bytes can be written without
+ * checking TXDATA for space. Returns once the last byte has been shifted out,
+ * or 1 if the FIFO stops draining before the deadline. */
+static int spi_transmit_only(struct metal_spi *gspi, long control_base,
+                             size_t i, size_t end, char *tx_buf,
+                             struct metal_deadline *endwait) {
+    size_t n;
+
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_FMT) |= METAL_SPI_DISABLE_RX;
+
+    /* TXWM is pending while fewer than TXMARK bytes are queued */
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXMARK) = METAL_SPI_TX_BURST_MARK;
+
+    while (i < end) {
+        if (METAL_SPI_REGW(METAL_SIFIVE_SPI0_IP) & METAL_SPI_TXWM) {
+            n = __METAL_MIN(METAL_SPI_FIFO_DEPTH - METAL_SPI_TX_BURST_MARK + 1,
+                            end - i);
+        } else if (!(METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXDATA) &
+                     METAL_SPI_TXDATA_FULL)) {
+            n = 1;
+        } else {
+            if (metal_deadline_expired(endwait)) {
+                return 1;
+            }
+            continue;
+        }
+
+        for (; n > 0; n--, i++) {
+            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = tx_buf ? tx_buf[i] : 0;
+        }
+        metal_deadline_rearm(endwait);
+    }
+
+    /* Wait for the transmit FIFO to empty */
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXMARK) = 1;
+    while ((METAL_SPI_REGW(METAL_SIFIVE_SPI0_IP) & METAL_SPI_TXWM) == 0) {
+        if (metal_deadline_expired(endwait)) {
+            return 1;
+        }
+    }
+
+    return spi_wait_frame(gspi, control_base, endwait);
+}
+
 int __metal_driver_sifive_spi0_transfer(struct metal_spi *gspi,
                                         struct metal_spi_config *config,
                                         size_t len, char *tx_buf,
@@ -167,6 +396,13 @@ int __metal_driver_sifive_spi0_transfer(struct metal_spi *gspi,
     long control_base = __metal_driver_sifive_spi0_control_base(gspi);
     int rc = 0;
     size_t i = 0;
+    size_t end;
+    int phase;
+
+    /* The bus belongs to the asynchronous engine until its queue drains */
+    if (spi->async_active || (spi->async_head != spi->async_tail)) {
+        return -1;
+    }
 
     rc = configure_spi(spi, config);
     if (rc != 0) {
@@ -177,155 +413,234 @@ int __metal_driver_sifive_spi0_transfer(struct metal_spi *gspi,
     METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &= ~(METAL_SPI_CSMODE_MASK);
     METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) |= METAL_SPI_CSMODE_HOLD;
 
-    unsigned long rxdata;
+    /* Deadline to break out of infinite while loop */
+    struct metal_deadline endwait;
 
-    /* Declare time_t variables to break out of infinite while loop */
-    time_t endwait;
+    metal_deadline_init_us(&endwait, METAL_SPI_RXDATA_TIMEOUT_US);
 
-    for (i = 0; i < config->cmd_num; i++) {
+    for (phase = 0; phase < METAL_SPI_NUM_PHASES; phase++) {
+        spi_phase_switch(spi, config, phase);
 
-        while (METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXDATA) & METAL_SPI_TXDATA_FULL)
-            ;
+        end = spi_phase_end(config, len, phase);
+        if (i >= end) {
+            continue;
+        }
+
+        metal_deadline_rearm(&endwait);
 
-        if (tx_buf) {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = tx_buf[i];
+        if ((phase == METAL_SPI_PHASE_DATA) && (rx_buf == NULL)) {
+            /* Nothing to receive, so stop populating the receive FIFO and
+             * stream the data phase */
+            rc = spi_transmit_only(gspi, control_base, i, end, tx_buf,
+                                   &endwait);
         } else {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = 0;
+            rc = spi_pipeline(control_base, i, end, tx_buf, rx_buf, &endwait);
+        }
+
+        if (rc != 0) {
+            /* If timeout, deassert the CS and return error code 1 */
+            spi_release(spi);
+            return rc;
         }
+        i = end;
+    }
 
-        endwait = metal_time() + METAL_SPI_RXDATA_TIMEOUT;
+    /* Every byte has been shifted out */
+    spi_release(spi);
 
-        while ((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
-               METAL_SPI_RXDATA_EMPTY) {
-            if (metal_time() > endwait) {
-                METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &=
-                    ~(METAL_SPI_CSMODE_MASK);
+    return 0;
+}
 
-                return 1;
+/* The asynchronous engine needs the interrupt parent and line of the
+ * device, which the machine header only provides along with
+ * __METAL_SIFIVE_SPI0_INTERRUPTS */
+#ifdef __METAL_SIFIVE_SPI0_INTERRUPTS
+
+/* Move the active asynchronous transfer forward as far as the FIFOs allow.
+ * Like spi_pipeline(), up to METAL_SPI_FIFO_DEPTH bytes are kept in flight,
+ * and RXMARK is set so that RXWM fires once half of them have arrived.
+ * Returns 1 while bytes are still in flight, 0 once the transfer is done. */
+static int spi_async_advance(struct __metal_driver_sifive_spi0 *spi) {
+    long control_base =
+        __metal_driver_sifive_spi0_control_base((struct metal_spi *)spi);
+    struct __metal_driver_sifive_spi0_transaction *t =
+        &spi->async_queue[spi->async_head %
+                          __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH];
+    unsigned long rxdata;
+    size_t end, in_flight;
+
+    while (1) {
+        /* Collect what has arrived */
+        while ((spi->async_rx_i < spi->async_tx_i) &&
+               !((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
+                 METAL_SPI_RXDATA_EMPTY)) {
+            if (t->rx_buf) {
+                t->rx_buf[spi->async_rx_i] =
+                    (char)(rxdata & METAL_SPI_TXRXDATA_MASK);
             }
+            spi->async_rx_i++;
         }
 
-        if (rx_buf) {
-            rx_buf[i] = (char)(rxdata & METAL_SPI_TXRXDATA_MASK);
+        end = spi_phase_end(t->config, t->len, spi->async_phase);
+        if (spi->async_rx_i < end) {
+            break;
         }
+        if (spi->async_phase == METAL_SPI_PHASE_DATA) {
+            return 0;
+        }
+        spi->async_phase++;
+        spi_phase_switch(spi, t->config, spi->async_phase);
     }
 
-    /* switch to Dual/Quad mode */
-    spi_mode_switch(spi, config, MULTI_WIRE_ADDR_DATA);
+    /* Top up the transmit FIFO without crossing into the next phase */
+    while ((spi->async_tx_i < end) &&
+           (spi->async_tx_i - spi->async_rx_i < METAL_SPI_FIFO_DEPTH)) {
+        METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) =
+            t->tx_buf ? t->tx_buf[spi->async_tx_i] : 0;
+        spi->async_tx_i++;
+    }
 
-    /* Send Addr data */
-    for (; i < (config->cmd_num + config->addr_num); i++) {
+    /* RXWM is pending while more than RXMARK bytes are queued */
+    in_flight = spi->async_tx_i - spi->async_rx_i;
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXMARK) =
+        ((in_flight > 1 ? in_flight / 2 : 1) - 1) & METAL_SPI_RXMARK_MASK;
 
-        while (METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXDATA) & METAL_SPI_TXDATA_FULL)
-            ;
-
-        if (tx_buf) {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = tx_buf[i];
-        } else {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = 0;
-        }
+    return 1;
+}
 
-        endwait = metal_time() + METAL_SPI_RXDATA_TIMEOUT;
+/* Retire the transfer at the head of the queue and report its status */
+static void spi_async_complete(struct __metal_driver_sifive_spi0 *spi,
+                               int status) {
+    struct __metal_driver_sifive_spi0_transaction *t =
+        &spi->async_queue[spi->async_head %
+                          __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH];
+    metal_spi_callback_t callback = t->callback;
+    void *priv = t->priv;
 
-        while ((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
-               METAL_SPI_RXDATA_EMPTY) {
-            if (metal_time() > endwait) {
-                METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &=
-                    ~(METAL_SPI_CSMODE_MASK);
+    /* Every byte has been received, release the chip select */
+    spi_release(spi);
 
-                return 1;
-            }
-        }
+    spi->async_head++;
+    spi->async_active = 0;
 
-        if (rx_buf) {
-            rx_buf[i] = (char)(rxdata & METAL_SPI_TXRXDATA_MASK);
-        }
+    if (callback) {
+        callback(&spi->spi, status, priv);
     }
+}
 
-    /* Send Dummy data */
-    for (; i < (config->cmd_num + config->addr_num + config->dummy_num); i++) {
+/* Start queued transfers until one of them is left waiting on the bus.
+ * Must be called from the interrupt handler or with RXWM masked. */
+static void spi_async_start(struct __metal_driver_sifive_spi0 *spi) {
+    long control_base =
+        __metal_driver_sifive_spi0_control_base((struct metal_spi *)spi);
+    struct __metal_driver_sifive_spi0_transaction *t;
 
-        while (METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXDATA) & METAL_SPI_TXDATA_FULL)
-            ;
+    while (!spi->async_active && (spi->async_head != spi->async_tail)) {
+        t = &spi->async_queue[spi->async_head %
+                              __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH];
 
-        if (tx_buf) {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = tx_buf[i];
-        } else {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = 0;
+        if (configure_spi(spi, t->config) != 0) {
+            spi_async_complete(spi, -1);
+            continue;
         }
 
-        endwait = metal_time() + METAL_SPI_RXDATA_TIMEOUT;
+        /* Hold the chip select line for all len transferred */
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &= ~(METAL_SPI_CSMODE_MASK);
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) |= METAL_SPI_CSMODE_HOLD;
 
-        while ((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
-               METAL_SPI_RXDATA_EMPTY) {
-            if (metal_time() > endwait) {
-                METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &=
-                    ~(METAL_SPI_CSMODE_MASK);
-                return 1;
-            }
-        }
-        if (rx_buf) {
-            rx_buf[i] = (char)(rxdata & METAL_SPI_TXRXDATA_MASK);
+        spi->async_active = 1;
+        spi->async_phase = METAL_SPI_PHASE_CMD;
+        spi->async_tx_i = 0;
+        spi->async_rx_i = 0;
+
+        if (spi_async_advance(spi)) {
+            METAL_SPI_REGW(METAL_SIFIVE_SPI0_IE) |= METAL_SPI_RXWM;
+            return;
         }
+        spi_async_complete(spi, 0);
     }
 
-    /* switch to Dual/Quad mode */
-    spi_mode_switch(spi, config, MULTI_WIRE_DATA_ONLY);
-
-    for (; i < len; i++) {
-        /* Master send bytes to the slave */
-
-        /* Wait for TXFIFO to not be full */
-        while (METAL_SPI_REGW(METAL_SIFIVE_SPI0_TXDATA) & METAL_SPI_TXDATA_FULL)
-            ;
+    if (!spi->async_active) {
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_IE) &= ~METAL_SPI_RXWM;
+    }
+}
 
-        /* Transfer byte by modifying the least significant byte in the TXDATA
-         * register */
-        if (tx_buf) {
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = tx_buf[i];
-        } else {
-            /* Transfer a 0 byte if the sending buffer is NULL */
-            METAL_SPI_REGB(METAL_SIFIVE_SPI0_TXDATA) = 0;
-        }
+static void __metal_driver_sifive_spi0_isr(int id, void *priv) {
+    struct __metal_driver_sifive_spi0 *spi = priv;
 
-        /* Master receives bytes from the RX FIFO */
+    if (spi->async_active && spi_async_advance(spi)) {
+        return;
+    }
+    if (spi->async_active) {
+        spi_async_complete(spi, 0);
+    }
+    spi_async_start(spi);
+}
 
-        /* Wait for RXFIFO to not be empty, but break the nested loops if
-         * timeout this timeout method  needs refining, preferably taking into
-         * account the device specs */
-        endwait = metal_time() + METAL_SPI_RXDATA_TIMEOUT;
+int __metal_driver_sifive_spi0_transfer_async(
+    struct metal_spi *gspi, struct metal_spi_config *config, size_t len,
+    char *tx_buf, char *rx_buf, metal_spi_callback_t callback, void *priv) {
+    struct __metal_driver_sifive_spi0 *spi = (void *)gspi;
+    long control_base = __metal_driver_sifive_spi0_control_base(gspi);
+    struct __metal_driver_sifive_spi0_transaction *t;
 
-        while ((rxdata = METAL_SPI_REGW(METAL_SIFIVE_SPI0_RXDATA)) &
-               METAL_SPI_RXDATA_EMPTY) {
-            if (metal_time() > endwait) {
-                /* If timeout, deassert the CS */
-                METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &=
-                    ~(METAL_SPI_CSMODE_MASK);
+    if (!spi->async_irq_registered) {
+        struct metal_interrupt *intc =
+            __metal_driver_sifive_spi0_interrupt_parent(gspi);
+        int id = __metal_driver_sifive_spi0_interrupt_line(gspi);
 
-                /* If timeout, return error code 1 immediately */
-                return 1;
-            }
+        if (intc == NULL) {
+            return -1;
         }
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_IE) = 0;
+        if (metal_interrupt_register_handler(
+                intc, id, __metal_driver_sifive_spi0_isr, spi) != 0) {
+            return -1;
+        }
+        metal_interrupt_enable(intc, id);
+        spi->async_irq_registered = 1;
+    }
+
+    /* Keep the interrupt handler away from the queue while it is updated */
+    METAL_SPI_REGW(METAL_SIFIVE_SPI0_IE) &= ~METAL_SPI_RXWM;
 
-        /* Only store the dequeued byte if the receive_buffer is not NULL */
-        if (rx_buf) {
-            rx_buf[i] = (char)(rxdata & METAL_SPI_TXRXDATA_MASK);
+    if (spi->async_tail - spi->async_head >=
+        __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH) {
+        if (spi->async_active) {
+            METAL_SPI_REGW(METAL_SIFIVE_SPI0_IE) |= METAL_SPI_RXWM;
         }
+        return -1;
     }
 
-    /* On the last byte, set CSMODE to auto so that the chip select transitions
-     * back to high The reason that CS pin is not deasserted after transmitting
-     * out the byte buffer is timing. The code on the host side likely executes
-     * faster than the ability of FIFO to send out bytes. After the host
-     * iterates through the array, fifo is likely not cleared yet. If host
-     * deasserts the CS pin immediately, the following bytes in the output FIFO
-     * will not be sent consecutively.
-     * There needs to be a better way to handle this. */
-    METAL_SPI_REGW(METAL_SIFIVE_SPI0_CSMODE) &= ~(METAL_SPI_CSMODE_MASK);
+    t = &spi->async_queue[spi->async_tail %
+                          __METAL_SIFIVE_SPI0_ASYNC_QUEUE_DEPTH];
+    t->config = config;
+    t->len = len;
+    t->tx_buf = tx_buf;
+    t->rx_buf = rx_buf;
+    t->callback = callback;
+    t->priv = priv;
+    spi->async_tail++;
+
+    if (spi->async_active) {
+        METAL_SPI_REGW(METAL_SIFIVE_SPI0_IE) |= METAL_SPI_RXWM;
+    } else {
+        spi_async_start(spi);
+    }
 
     return 0;
 }
 
+#else
+
+int __metal_driver_sifive_spi0_transfer_async(
+    struct metal_spi *gspi, struct metal_spi_config *config, size_t len,
+    char *tx_buf, char *rx_buf, metal_spi_callback_t callback, void *priv) {
+    return -1;
+}
+
+#endif /* __METAL_SIFIVE_SPI0_INTERRUPTS */
+
 int __metal_driver_sifive_spi0_get_baud_rate(struct metal_spi *gspi) {
     struct __metal_driver_sifive_spi0 *spi = (void *)gspi;
     return spi->baud_rate;
@@ -360,6 +675,65 @@ int __metal_driver_sifive_spi0_set_baud_rate(struct metal_spi *gspi,
     return 0;
 }
 
+static unsigned long spi_flash_proto(unsigned int protocol) {
+    switch (protocol) {
+    case METAL_SPI_SINGLE:
+        return METAL_SPI_PROTO_SINGLE;
+    case METAL_SPI_DUAL:
+        return METAL_SPI_PROTO_DUAL;
+    case METAL_SPI_QUAD:
+        return METAL_SPI_PROTO_QUAD;
+    default:
+        return METAL_SPI_PROTO_MASK;
+    }
+}
+
+int __metal_driver_sifive_spi0_set_flash_format(
+    struct metal_spi *gspi, struct metal_spi_flash_format *format) {
+    long control_base = __metal_driver_sifive_spi0_control_base(gspi);
+    unsigned long cmd_proto = spi_flash_proto(format->cmd_protocol);
+    unsigned long addr_proto = spi_flash_proto(format->addr_protocol);
+    unsigned long data_proto = spi_flash_proto(format->data_protocol);
+    unsigned long ffmt;
+
+    if ((format->addr_len > METAL_SPI_FFMT_ADDR_LEN_MAX) ||
+        (format->pad_cnt > METAL_SPI_FFMT_PAD_CNT_MAX) ||
+        (cmd_proto == METAL_SPI_PROTO_MASK) ||
+        (addr_proto == METAL_SPI_PROTO_MASK) ||
+        (data_proto == METAL_SPI_PROTO_MASK)) {
+        return -1;
+    }
+
+    ffmt = (format->cmd_en ? METAL_SPI_FFMT_CMD_EN : 0) |
+           (format->addr_len << METAL_SPI_FFMT_ADDR_LEN_SHIFT) |
+           (format->pad_cnt << METAL_SPI_FFMT_PAD_CNT_SHIFT) |
+           (cmd_proto << METAL_SPI_FFMT_CMD_PROTO_SHIFT) |
+           (addr_proto << METAL_SPI_FFMT_ADDR_PROTO_SHIFT) |
+           (data_proto << METAL_SPI_FFMT_DATA_PROTO_SHIFT) |
+           ((unsigned long)format->cmd_code << METAL_SPI_FFMT_CMD_CODE_SHIFT) |
+           ((unsigned long)format->pad_code << METAL_SPI_FFMT_PAD_CODE_SHIFT);
+
+    spi_flash_format(control_base, ffmt);
+
+    return 0;
+}
+
+int __metal_driver_sifive_spi0_set_flash_mapped(struct metal_spi *gspi,
+                                                int enable) {
+    struct __metal_driver_sifive_spi0 *spi = (void *)gspi;
+    long control_base = __metal_driver_sifive_spi0_control_base(gspi);
+
+    /* A transfer owns the interface and restores the mode when it ends */
+    if (spi->async_active || (spi->async_head != spi->async_tail)) {
+        return -1;
+    }
+
+    spi_flash_control(control_base, enable ? METAL_SPI_CONTROL_MAPPED
+                                           : METAL_SPI_CONTROL_IO);
+
+    return 0;
+}
+
 static void pre_rate_change_callback_func(void *priv) {
     long control_base =
         __metal_driver_sifive_spi0_control_base((struct metal_spi *)priv);
@@ -414,8 +788,11 @@ void __metal_driver_sifive_spi0_init(struct metal_spi *gspi, int baud_rate) {
 __METAL_DEFINE_VTABLE(__metal_driver_vtable_sifive_spi0) = {
     .spi.init = __metal_driver_sifive_spi0_init,
     .spi.transfer = __metal_driver_sifive_spi0_transfer,
+    .spi.transfer_async = __metal_driver_sifive_spi0_transfer_async,
     .spi.get_baud_rate = __metal_driver_sifive_spi0_get_baud_rate,
     .spi.set_baud_rate = __metal_driver_sifive_spi0_set_baud_rate,
+    .spi.set_flash_format = __metal_driver_sifive_spi0_set_flash_format,
+    .spi.set_flash_mapped = __metal_driver_sifive_spi0_set_flash_mapped,
 };
 #endif /* METAL_SIFIVE_SPI0 */
 
@@ -34,10 +34,12 @@ static void write_itc_uint8(struct metal_uart *trace, uint8_t data) {
     TRACE_REG8(METAL_SIFIVE_TRACE_ITCSTIMULUS + 3) = data;
 }
 
-int __metal_driver_sifive_trace_putc(struct metal_uart *trace, int c) {
-    static uint32_t buffer = 0;
-    static int bytes_in_buffer = 0;
+/* Bytes from putc() are packed into a word before being written to the ITC
+ * stimulus register */
+static uint32_t buffer = 0;
+static int bytes_in_buffer = 0;
 
+int __metal_driver_sifive_trace_putc(struct metal_uart *trace, int c) {
     buffer |= (((uint32_t)c) << (bytes_in_buffer * 8));
 
     bytes_in_buffer += 1;
@@ -68,6 +70,30 @@ int __metal_driver_sifive_trace_putc(struct metal_uart *trace, int c) {
     return c;
 }
 
+int __metal_driver_sifive_trace_write_buf(struct metal_uart *trace,
+                                          const char *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t i = 0;
+
+    // top up a word left partially filled by putc
+    while ((i < len) && (bytes_in_buffer != 0)) {
+        __metal_driver_sifive_trace_putc(trace, p[i++]);
+    }
+
+    // whole words go straight to the stimulus register
+    for (; i + 4 <= len; i += 4) {
+        write_itc_uint32(trace, (uint32_t)p[i] | ((uint32_t)p[i + 1] << 8) |
+                                    ((uint32_t)p[i + 2] << 16) |
+                                    ((uint32_t)p[i + 3] << 24));
+    }
+
+    while (i < len) {
+        __metal_driver_sifive_trace_putc(trace, p[i++]);
+    }
+
+    return 0;
+}
+
 void __metal_driver_sifive_trace_init(struct metal_uart *trace, int baud_rate) {
     // The only init we do here is to make sure ITC 0 is enabled. It is up to
     // Freedom Studio or other mechanisms to make sure tracing is enabled. If we
@@ -82,6 +108,7 @@ void __metal_driver_sifive_trace_init(struct metal_uart *trace, int baud_rate) {
 __METAL_DEFINE_VTABLE(__metal_driver_vtable_sifive_trace) = {
     .uart.init = __metal_driver_sifive_trace_init,
     .uart.putc = __metal_driver_sifive_trace_putc,
+    .uart.write_buf = __metal_driver_sifive_trace_write_buf,
     .uart.getc = NULL,
 
     .uart.get_baud_rate = NULL,
@@ -7,6 +7,7 @@
 
 #include <metal/drivers/sifive_uart0.h>
 #include <metal/machine.h>
+#include <metal/time.h>
 
 /* TXDATA Fields */
 #define UART_TXEN (1 << 0)
@@ -27,6 +28,14 @@
 #define UART_TXWM (1 << 0)
 #define UART_RXWM (1 << 1)
 
+/* Depth of the transmit and receive FIFOs */
+#define UART_FIFO_DEPTH 8
+
+/* Watermarks used in buffered mode: refill the transmit FIFO once it drains
+ * below half full, and empty the receive FIFO as soon as a byte arrives. */
+#define UART_BUFFERED_TXCNT (UART_FIFO_DEPTH / 2)
+#define UART_BUFFERED_RXCNT 0
+
 #define UART_REG(offset) (((unsigned long)control_base + offset))
 #define UART_REGB(offset)                                                      \
     (__METAL_ACCESS_ONCE((__metal_io_u8 *)UART_REG(offset)))
@@ -80,7 +89,9 @@ int __metal_driver_sifive_uart0_set_tx_watermark(struct metal_uart *uart,
                                                  size_t level) {
     long control_base = __metal_driver_sifive_uart0_control_base(uart);
 
-    UART_REGW(METAL_SIFIVE_UART0_TXCTRL) |= UART_TXCNT(level);
+    UART_REGW(METAL_SIFIVE_UART0_TXCTRL) =
+        (UART_REGW(METAL_SIFIVE_UART0_TXCTRL) & ~UART_TXCNT(0x7)) |
+        UART_TXCNT(level);
     return 0;
 }
 
@@ -94,7 +105,9 @@ int __metal_driver_sifive_uart0_set_rx_watermark(struct metal_uart *uart,
                                                  size_t level) {
     long control_base = __metal_driver_sifive_uart0_control_base(uart);
 
-    UART_REGW(METAL_SIFIVE_UART0_RXCTRL) |= UART_RXCNT(level);
+    UART_REGW(METAL_SIFIVE_UART0_RXCTRL) =
+        (UART_REGW(METAL_SIFIVE_UART0_RXCTRL) & ~UART_RXCNT(0x7)) |
+        UART_RXCNT(level);
     return 0;
 }
 
@@ -104,19 +117,193 @@ size_t __metal_driver_sifive_uart0_get_rx_watermark(struct metal_uart *uart) {
     return ((UART_REGW(METAL_SIFIVE_UART0_RXCTRL) >> 16) & 0x7);
 }
 
-int __metal_driver_sifive_uart0_putc(struct metal_uart *uart, int c) {
-    long control_base = __metal_driver_sifive_uart0_control_base(uart);
+static int __metal_driver_sifive_uart0_ring_put(
+    struct __metal_driver_sifive_uart0_ring *ring, char c,
+    size_t *high_water) {
+    size_t head = ring->head;
+    size_t used = head - ring->tail;
+
+    if (used > ring->mask) {
+        return 0;
+    }
+    ring->buf[head & ring->mask] = c;
+
+    /* Publish the byte before the index which makes it visible */
+    __METAL_IO_FENCE(rw, w);
+    ring->head = head + 1;
+
+    if (used + 1 > *high_water) {
+        *high_water = used + 1;
+    }
+    return 1;
+}
+
+static int __metal_driver_sifive_uart0_ring_get(
+    struct __metal_driver_sifive_uart0_ring *ring, char *c) {
+    size_t tail = ring->tail;
+
+    if (ring->head == tail) {
+        return 0;
+    }
+    __METAL_IO_FENCE(r, rw);
+    *c = ring->buf[tail & ring->mask];
+
+    /* Finish reading the byte before handing the slot back */
+    __METAL_IO_FENCE(rw, w);
+    ring->tail = tail + 1;
+    return 1;
+}
+
+/* Move bytes from the transmit ring into the FIFO until one of them runs out.
+ * Returns 1 if the transmit ring is empty. Must only be called from the
+ * interrupt handler or with the TXWM interrupt disabled. */
+static int __metal_driver_sifive_uart0_tx_drain(struct metal_uart *guart) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    char c;
+
+    while (uart->tx_ring.head != uart->tx_ring.tail) {
+        if (UART_REGW(METAL_SIFIVE_UART0_TXDATA) & UART_TXFULL) {
+            return 0;
+        }
+        __metal_driver_sifive_uart0_ring_get(&uart->tx_ring, &c);
+        UART_REGW(METAL_SIFIVE_UART0_TXDATA) = (unsigned char)c;
+    }
+    return 1;
+}
+
+/* Move bytes from the FIFO into the receive ring, dropping and counting them
+ * once the ring is full. Must only be called from the interrupt handler or
+ * with the RXWM interrupt disabled. */
+static void __metal_driver_sifive_uart0_rx_fill(struct metal_uart *guart) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    uint32_t ch;
+
+    while (!((ch = UART_REGW(METAL_SIFIVE_UART0_RXDATA)) & UART_RXEMPTY)) {
+        if (!__metal_driver_sifive_uart0_ring_put(&uart->rx_ring, ch & 0xff,
+                                                  &uart->stats.rx_high_water)) {
+            uart->stats.rx_overflow++;
+        }
+    }
+}
 
-    while (__metal_driver_sifive_uart0_txready(uart) != 0) {
+static void __metal_driver_sifive_uart0_isr(int id, void *priv) {
+    struct metal_uart *guart = priv;
+    struct __metal_driver_sifive_uart0 *uart = priv;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    uint32_t ip = UART_REGW(METAL_SIFIVE_UART0_IP);
+
+    if ((ip & UART_RXWM) && uart->rx_ring.buf != NULL) {
+        __metal_driver_sifive_uart0_rx_fill(guart);
+    }
+    if (ip & UART_TXWM) {
+        if (__metal_driver_sifive_uart0_tx_drain(guart)) {
+            /* Nothing left to send, stay quiet until more bytes are queued */
+            UART_REGW(METAL_SIFIVE_UART0_IE) &= ~UART_TXWM;
+        }
+    }
+}
+
+/* Queue bytes on the transmit ring and make sure the TXWM interrupt is armed
+ * to drain them. If block is set, wait for room instead of giving up when the
+ * ring is full. */
+static size_t __metal_driver_sifive_uart0_tx_queue(struct metal_uart *guart,
+                                                   const char *buf, size_t len,
+                                                   int block) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    size_t i = 0;
+
+    while (i < len) {
+        if (__metal_driver_sifive_uart0_ring_put(&uart->tx_ring, buf[i],
+                                                 &uart->stats.tx_high_water)) {
+            i++;
+            continue;
+        }
+        if (!block) {
+            uart->stats.tx_overflow += len - i;
+            break;
+        }
+        /* The ring is full. Drain it by hand with the interrupt masked so
+         * that we make progress even if interrupts are disabled. */
+        UART_REGW(METAL_SIFIVE_UART0_IE) &= ~UART_TXWM;
+        __metal_driver_sifive_uart0_tx_drain(guart);
+    }
+
+    if (i > 0) {
+        UART_REGW(METAL_SIFIVE_UART0_IE) |= UART_TXWM;
+    }
+    return i;
+}
+
+int __metal_driver_sifive_uart0_putc(struct metal_uart *guart, int c) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    char ch = c;
+
+    if (uart->tx_ring.buf != NULL) {
+        __metal_driver_sifive_uart0_tx_queue(guart, &ch, 1, 1);
+        return 0;
+    }
+
+    while (__metal_driver_sifive_uart0_txready(guart) != 0) {
         /* wait */
     }
     UART_REGW(METAL_SIFIVE_UART0_TXDATA) = c;
     return 0;
 }
 
-int __metal_driver_sifive_uart0_getc(struct metal_uart *uart, int *c) {
+int __metal_driver_sifive_uart0_write_buf(struct metal_uart *guart,
+                                          const char *buf, size_t len) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    size_t txcnt, burst, n;
+
+    if (uart->tx_ring.buf != NULL) {
+        __metal_driver_sifive_uart0_tx_queue(guart, buf, len, 1);
+        return 0;
+    }
+
+    /* A pending TXWM means the FIFO holds fewer than txcnt entries, so at
+     * least UART_FIFO_DEPTH - txcnt + 1 bytes can be written without checking
+     * TXFULL again. If the watermark is disabled, fall back to one byte per
+     * status check. */
+    txcnt = __metal_driver_sifive_uart0_get_tx_watermark(guart);
+    burst = txcnt ? UART_FIFO_DEPTH - txcnt + 1 : 1;
+
+    while (len > 0) {
+        if (UART_REGW(METAL_SIFIVE_UART0_IP) & UART_TXWM) {
+            n = __METAL_MIN(burst, len);
+        } else if (!(UART_REGW(METAL_SIFIVE_UART0_TXDATA) & UART_TXFULL)) {
+            n = 1;
+        } else {
+            continue;
+        }
+
+        len -= n;
+        while (n-- > 0) {
+            UART_REGW(METAL_SIFIVE_UART0_TXDATA) = (unsigned char)*buf++;
+        }
+    }
+    return 0;
+}
+
+int __metal_driver_sifive_uart0_getc(struct metal_uart *guart, int *c) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
     uint32_t ch;
-    long control_base = __metal_driver_sifive_uart0_control_base(uart);
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+
+    if (uart->rx_ring.buf != NULL) {
+        char byte;
+        if (__metal_driver_sifive_uart0_ring_get(&uart->rx_ring, &byte)) {
+            *c = (unsigned char)byte;
+        } else {
+            *c = -1;
+        }
+        return 0;
+    }
+
     /* No seperate status register, we get status and the byte at same time */
     ch = UART_REGW(METAL_SIFIVE_UART0_RXDATA);
     ;
@@ -128,6 +315,119 @@ int __metal_driver_sifive_uart0_getc(struct metal_uart *uart, int *c) {
     return 0;
 }
 
+int __metal_driver_sifive_uart0_write(struct metal_uart *guart,
+                                      const char *buf, size_t len) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    size_t i;
+
+    if (uart->tx_ring.buf != NULL) {
+        return __metal_driver_sifive_uart0_tx_queue(guart, buf, len, 0);
+    }
+
+    for (i = 0; i < len; i++) {
+        if (UART_REGW(METAL_SIFIVE_UART0_TXDATA) & UART_TXFULL) {
+            break;
+        }
+        UART_REGW(METAL_SIFIVE_UART0_TXDATA) = (unsigned char)buf[i];
+    }
+    return i;
+}
+
+int __metal_driver_sifive_uart0_read(struct metal_uart *guart, char *buf,
+                                     size_t len) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    uint32_t ch;
+    size_t i;
+
+    if (uart->rx_ring.buf != NULL) {
+        for (i = 0; i < len; i++) {
+            if (!__metal_driver_sifive_uart0_ring_get(&uart->rx_ring,
+                                                      &buf[i])) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    for (i = 0; i < len; i++) {
+        ch = UART_REGW(METAL_SIFIVE_UART0_RXDATA);
+        if (ch & UART_RXEMPTY) {
+            break;
+        }
+        buf[i] = ch & 0xff;
+    }
+    return i;
+}
+
+int __metal_driver_sifive_uart0_set_buffers(struct metal_uart *guart,
+                                            char *tx_buf, size_t tx_len,
+                                            char *rx_buf, size_t rx_len) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+    long control_base = __metal_driver_sifive_uart0_control_base(guart);
+    struct metal_interrupt *intc =
+        __metal_driver_sifive_uart0_interrupt_parent(guart);
+    int id = __metal_driver_sifive_uart0_interrupt_line(guart);
+
+    /* Ring indices are masked, so lengths must be powers of two */
+    if ((tx_buf != NULL && (tx_len == 0 || (tx_len & (tx_len - 1)) != 0)) ||
+        (rx_buf != NULL && (rx_len == 0 || (rx_len & (rx_len - 1)) != 0))) {
+        return -1;
+    }
+
+    /* Quiesce the UART interrupts while the rings are swapped out. Bytes
+     * still queued for transmit are flushed to the FIFO first. */
+    UART_REGW(METAL_SIFIVE_UART0_IE) &= ~(UART_TXWM | UART_RXWM);
+    while (!__metal_driver_sifive_uart0_tx_drain(guart)) {
+        /* wait */
+    }
+
+    uart->tx_ring.buf = tx_buf;
+    uart->tx_ring.mask = tx_len - 1;
+    uart->tx_ring.head = 0;
+    uart->tx_ring.tail = 0;
+    uart->rx_ring.buf = rx_buf;
+    uart->rx_ring.mask = rx_len - 1;
+    uart->rx_ring.head = 0;
+    uart->rx_ring.tail = 0;
+
+    if (tx_buf == NULL && rx_buf == NULL) {
+        return 0;
+    }
+
+    if (intc == NULL) {
+        uart->tx_ring.buf = NULL;
+        uart->rx_ring.buf = NULL;
+        return -1;
+    }
+
+    __metal_driver_sifive_uart0_set_tx_watermark(guart, UART_BUFFERED_TXCNT);
+    __metal_driver_sifive_uart0_set_rx_watermark(guart, UART_BUFFERED_RXCNT);
+
+    if (metal_interrupt_register_handler(intc, id,
+                                         __metal_driver_sifive_uart0_isr,
+                                         guart) != 0) {
+        uart->tx_ring.buf = NULL;
+        uart->rx_ring.buf = NULL;
+        return -1;
+    }
+    metal_interrupt_enable(intc, id);
+
+    if (rx_buf != NULL) {
+        UART_REGW(METAL_SIFIVE_UART0_IE) |= UART_RXWM;
+    }
+    return 0;
+}
+
+int __metal_driver_sifive_uart0_get_stats(struct metal_uart *guart,
+                                          struct metal_uart_stats *stats) {
+    struct __metal_driver_sifive_uart0 *uart = (void *)guart;
+
+    *stats = uart->stats;
+    return 0;
+}
+
 int __metal_driver_sifive_uart0_get_baud_rate(struct metal_uart *guart) {
     struct __metal_driver_sifive_uart0 *uart = (void *)guart;
     return uart->baud_rate;
@@ -172,11 +472,17 @@ static void pre_rate_change_callback_func(void *priv) {
 
     long bits_per_symbol =
         (UART_REGW(METAL_SIFIVE_UART0_TXCTRL) & (1 << 1)) ? 9 : 10;
-    long clk_freq = clock->vtable->get_rate_hz(clock);
-    long cycles_to_wait = bits_per_symbol * clk_freq / uart->baud_rate;
 
-    for (volatile long x = 0; x < cycles_to_wait; x++)
-        __asm__("nop");
+    /* Sleep rather than spin, since the timer isn't affected by the change
+     * of clock rate. Without a timer, fall back to counting cycles. */
+    if (metal_delay_us((bits_per_symbol * 1000000 + uart->baud_rate - 1) /
+                       uart->baud_rate) != 0) {
+        long clk_freq = clock->vtable->get_rate_hz(clock);
+        long cycles_to_wait = bits_per_symbol * clk_freq / uart->baud_rate;
+
+        for (volatile long x = 0; x < cycles_to_wait; x++)
+            __asm__("nop");
+    }
 }
 
 static void post_rate_change_callback_func(void *priv) {
@@ -206,6 +512,10 @@ void __metal_driver_sifive_uart0_init(struct metal_uart *guart, int baud_rate) {
 
     metal_uart_set_baud_rate(&(uart->uart), baud_rate);
 
+    /* Raise TXWM whenever the transmit FIFO is empty. write_buf() polls it to
+     * fill the whole FIFO after a single status check. */
+    __metal_driver_sifive_uart0_set_tx_watermark(guart, 1);
+
     if (pinmux != NULL) {
         long pinmux_output_selector =
             __metal_driver_sifive_uart0_pinmux_output_selector(guart);
@@ -220,6 +530,7 @@ void __metal_driver_sifive_uart0_init(struct metal_uart *guart, int baud_rate) {
 __METAL_DEFINE_VTABLE(__metal_driver_vtable_sifive_uart0) = {
     .uart.init = __metal_driver_sifive_uart0_init,
     .uart.putc = __metal_driver_sifive_uart0_putc,
+    .uart.write_buf = __metal_driver_sifive_uart0_write_buf,
     .uart.getc = __metal_driver_sifive_uart0_getc,
     .uart.txready = __metal_driver_sifive_uart0_txready,
     .uart.get_baud_rate = __metal_driver_sifive_uart0_get_baud_rate,
@@ -237,6 +548,10 @@ __METAL_DEFINE_VTABLE(__metal_driver_vtable_sifive_uart0) = {
     .uart.get_tx_watermark = __metal_driver_sifive_uart0_get_tx_watermark,
     .uart.set_rx_watermark = __metal_driver_sifive_uart0_set_rx_watermark,
     .uart.get_rx_watermark = __metal_driver_sifive_uart0_get_rx_watermark,
+    .uart.set_buffers = __metal_driver_sifive_uart0_set_buffers,
+    .uart.write = __metal_driver_sifive_uart0_write,
+    .uart.read = __metal_driver_sifive_uart0_read,
+    .uart.get_stats = __metal_driver_sifive_uart0_get_stats,
 };
 
 #endif /* METAL_SIFIVE_UART0 */
@@ -87,6 +87,19 @@ int __metal_driver_ucb_htif0_putc(struct metal_uart *htif, int c) {
     return 0;
 }
 
+int __metal_driver_ucb_htif0_write_buf(struct metal_uart *htif,
+                                       const char *buf, size_t len) {
+    volatile uint64_t magic_mem[8];
+    magic_mem[0] = 64; // SYS_write
+    magic_mem[1] = 1;
+    magic_mem[2] = (uintptr_t)buf;
+    magic_mem[3] = len;
+
+    do_tohost_fromhost(0, 0, (uintptr_t)magic_mem);
+
+    return 0;
+}
+
 int __metal_driver_ucb_htif0_getc(struct metal_uart *htif, int *c) {
     return -1;
 }
@@ -116,6 +129,7 @@ __METAL_DEFINE_VTABLE(__metal_driver_vtable_ucb_htif0_shutdown) = {
 __METAL_DEFINE_VTABLE(__metal_driver_vtable_ucb_htif0_uart) = {
     .uart.init = __metal_driver_ucb_htif0_init,
     .uart.putc = __metal_driver_ucb_htif0_putc,
+    .uart.write_buf = __metal_driver_ucb_htif0_write_buf,
     .uart.getc = __metal_driver_ucb_htif0_getc,
     .uart.get_baud_rate = __metal_driver_ucb_htif0_get_baud_rate,
     .uart.set_baud_rate = __metal_driver_ucb_htif0_set_baud_rate,
@@ -1,7 +1,14 @@
 /* Copyright 2019 SiFive Inc. */
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <metal/atomic.h>
+#include <metal/boot_log.h>
+#include <metal/drivers/riscv_cpu.h>
 #include <metal/init.h>
+#include <metal/io.h>
+#include <metal/machine.h>
+#include <metal/machine/platform.h>
+#include <stddef.h>
 
 /*
  * These function pointers are created by the linker script
@@ -14,6 +21,116 @@ extern metal_constructor_t metal_constructors_end;
 extern metal_destructor_t metal_destructors_start;
 extern metal_destructor_t metal_destructors_end;
 
+/*
+ * The linker collects METAL_CONSTRUCTOR_PARALLEL() entries into the
+ * metal_init_parallel section and defines these for it. They are weak so
+ * that programs without any parallel constructors still link.
+ */
+extern const metal_constructor_t __start_metal_init_parallel[]
+    __attribute__((weak));
+extern const metal_constructor_t __stop_metal_init_parallel[]
+    __attribute__((weak));
+
+/* The next parallel constructor to take, and the number which have returned */
+static metal_atomic_t __metal_init_parallel_next;
+static metal_atomic_t __metal_init_parallel_done;
+
+/* Take parallel constructors from the list and call them until it is empty */
+static void __metal_init_parallel_run(void) {
+    int count = __stop_metal_init_parallel - __start_metal_init_parallel;
+
+    while (1) {
+#ifdef __riscv_atomic
+        int i = metal_atomic_add(&__metal_init_parallel_next, 1);
+#else
+        int i = __metal_init_parallel_next++;
+#endif
+        if (i >= count) {
+            return;
+        }
+
+        metal_constructor_t func = __start_metal_init_parallel[i];
+        func();
+        __METAL_BOOT_LOG(METAL_BOOT_LOG_CONSTRUCTOR, (void *)func);
+
+#ifdef __riscv_atomic
+        metal_atomic_add(&__metal_init_parallel_done, 1);
+#else
+        __metal_init_parallel_done++;
+#endif
+    }
+}
+
+#if defined(METAL_INIT_PARALLEL) && defined(__riscv_atomic) &&                 \
+    __METAL_DT_MAX_HARTS > 1
+
+/* The secondary harts are woken with their software interrupt, since they
+ * can't touch memory until the boot hart has initialized it */
+static __metal_io_u32 *__metal_init_msip(int hart) {
+    uintptr_t msip_base = 0;
+
+#ifdef __METAL_DT_RISCV_CLINT0_HANDLE
+    msip_base = __metal_driver_sifive_clint0_control_base(
+        __METAL_DT_RISCV_CLINT0_HANDLE);
+    msip_base += METAL_RISCV_CLINT0_MSIP_BASE;
+#elif __METAL_DT_RISCV_CLIC0_HANDLE
+    msip_base =
+        __metal_driver_sifive_clic0_control_base(__METAL_DT_RISCV_CLIC0_HANDLE);
+    msip_base += METAL_RISCV_CLIC0_MSIP_BASE;
+#endif
+
+    if (msip_base == 0) {
+        return NULL;
+    }
+    return (__metal_io_u32 *)(msip_base + 4 * hart);
+}
+
+/* Called by crt0 on the secondary harts instead of skipping initialization */
+void __metal_init_help(void) {
+    int hart = __metal_myhart_id();
+    __metal_io_u32 *msip = __metal_init_msip(hart);
+    unsigned long mip;
+
+    /* The list is in read-only memory, so it can be checked before the boot
+     * hart has initialized the rest */
+    if ((msip == NULL) || (hart >= __METAL_DT_MAX_HARTS) ||
+        (__stop_metal_init_parallel - __start_metal_init_parallel == 0)) {
+        return;
+    }
+
+    /* Wait for the boot hart to open the list. This never ends if the
+     * boot hart doesn't call metal_init(), see metal_init_run() */
+    do {
+        __asm__ volatile("csrr %0, mip" : "=r"(mip));
+    } while (!(mip & METAL_LOCAL_INTERRUPT_SW));
+    __asm__ volatile("fence i, rw" ::: "memory");
+
+    __metal_init_parallel_run();
+
+    __METAL_ACCESS_ONCE(msip) = 0;
+}
+
+static void __metal_init_parallel_start(void) {
+    int boot_hart = __metal_myhart_id();
+
+    /* Publish the list before waking the secondary harts */
+    __asm__ volatile("fence rw, o" ::: "memory");
+    for (int hart = 0; hart < __METAL_DT_MAX_HARTS; hart++) {
+        __metal_io_u32 *msip = __metal_init_msip(hart);
+        if ((hart != boot_hart) && (msip != NULL)) {
+            __METAL_ACCESS_ONCE(msip) = 1;
+        }
+    }
+}
+
+#else
+
+void __metal_init_help(void) {}
+
+static void __metal_init_parallel_start(void) {}
+
+#endif
+
 void metal_init(void) {
     /* Make sure the constructors only run once */
     static int init_done = 0;
@@ -22,18 +139,52 @@ void metal_init(void) {
     }
     init_done = 1;
 
-    if (&metal_constructors_end <= &metal_constructors_start) {
-        return;
-    }
-
     metal_constructor_t *funcptr = &metal_constructors_start;
-    while (funcptr != &metal_constructors_end) {
+    while (funcptr < &metal_constructors_end) {
         metal_constructor_t func = *funcptr;
 
         func();
+        __METAL_BOOT_LOG(METAL_BOOT_LOG_CONSTRUCTOR, (void *)func);
 
         funcptr += 1;
     }
+
+    /* Then share the parallel constructors with any secondary harts, and
+     * wait for the ones they took to return */
+    int count = __stop_metal_init_parallel - __start_metal_init_parallel;
+    if (count > 0) {
+        __metal_init_parallel_start();
+        __metal_init_parallel_run();
+        while (__metal_init_parallel_done < count)
+            ;
+    }
+}
+
+void metal_init_once(struct metal_init_once *once) {
+    /* state is 0 before the constructor is called, 1 while it runs and 3
+     * once it has returned */
+    if (once->state == 3) {
+        /* Pairs with the fence before state is set, so that whatever the
+         * constructor wrote is visible here */
+        __asm__ volatile("fence r, rw" ::: "memory");
+        return;
+    }
+
+#ifdef __riscv_atomic
+    if (metal_atomic_or((metal_atomic_t *)&once->state, 1) != 0) {
+        while (once->state != 3)
+            ;
+        __asm__ volatile("fence r, rw" ::: "memory");
+        return;
+    }
+#else
+    once->state = 1;
+#endif
+
+    once->function();
+
+    __asm__ volatile("fence rw, w" ::: "memory");
+    once->state = 3;
 }
 
 void metal_fini(void) {
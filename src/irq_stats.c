@@ -0,0 +1,170 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/irq_stats.h>
+
+#ifdef METAL_IRQ_STATS
+
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/machine.h>
+#include <metal/machine/platform.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef METAL_RISCV_PLIC0
+#define METAL_IRQ_STATS_PLIC_IDS __METAL_PLIC_SUBINTERRUPTS
+#else
+#define METAL_IRQ_STATS_PLIC_IDS 0
+#endif
+
+#ifdef METAL_SIFIVE_CLIC0
+#define METAL_IRQ_STATS_CLIC_IDS __METAL_CLIC_SUBINTERRUPTS
+#else
+#define METAL_IRQ_STATS_CLIC_IDS 0
+#endif
+
+#define METAL_IRQ_STATS_IDS                                                    \
+    (METAL_MAX_MI + METAL_IRQ_STATS_PLIC_IDS + METAL_IRQ_STATS_CLIC_IDS)
+
+static const int __metal_irq_stats_ids[] = {
+    [METAL_IRQ_STATS_CPU] = METAL_MAX_MI,
+    [METAL_IRQ_STATS_PLIC] = METAL_IRQ_STATS_PLIC_IDS,
+    [METAL_IRQ_STATS_CLIC] = METAL_IRQ_STATS_CLIC_IDS,
+};
+
+static const char *const __metal_irq_stats_names[] = {
+    [METAL_IRQ_STATS_CPU] = "cpu",
+    [METAL_IRQ_STATS_PLIC] = "plic",
+    [METAL_IRQ_STATS_CLIC] = "clic",
+};
+
+/* Everything recorded by one hart. Each hart only ever writes its own entry,
+ * so entries are aligned to keep harts from sharing cache lines. */
+struct __metal_irq_stats_hart {
+    unsigned long long trap_entry;
+    struct metal_irq_stats irq[METAL_IRQ_STATS_IDS];
+} __attribute__((aligned(64)));
+
+static struct __metal_irq_stats_hart __metal_irq_stats[__METAL_DT_MAX_HARTS];
+
+static struct metal_irq_stats *
+__metal_irq_stats_find(int hartid, enum metal_irq_stats_source source,
+                       int id) {
+    int base = 0;
+
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS) ||
+        (source > METAL_IRQ_STATS_CLIC) || (id < 0) ||
+        (id >= __metal_irq_stats_ids[source])) {
+        return NULL;
+    }
+
+    for (int s = 0; s < source; s++) {
+        base += __metal_irq_stats_ids[s];
+    }
+    return &__metal_irq_stats[hartid].irq[base + id];
+}
+
+void __metal_irq_stats_enter(unsigned long long now) {
+    uintptr_t hartid = __metal_myhart_id();
+
+    if (hartid < __METAL_DT_MAX_HARTS) {
+        __metal_irq_stats[hartid].trap_entry = now;
+    }
+}
+
+void __metal_irq_stats_record(enum metal_irq_stats_source source, int id,
+                              unsigned long long start,
+                              unsigned long long end) {
+    int hartid = __metal_myhart_id();
+    struct metal_irq_stats *stats = __metal_irq_stats_find(hartid, source, id);
+    unsigned long latency, run;
+    int bucket = 0;
+
+    if (stats == NULL) {
+        return;
+    }
+
+    latency = start - __metal_irq_stats[hartid].trap_entry;
+    run = end - start;
+
+    if ((stats->count == 0) || (latency < stats->latency_min)) {
+        stats->latency_min = latency;
+    }
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
+    stats->latency_total += latency;
+
+    if ((stats->count == 0) || (run < stats->run_min)) {
+        stats->run_min = run;
+    }
+    if (run > stats->run_max) {
+        stats->run_max = run;
+    }
+    stats->run_total += run;
+
+    while ((bucket < METAL_IRQ_STATS_BUCKETS - 1) &&
+           (latency >> (bucket + METAL_IRQ_STATS_BUCKET_SHIFT))) {
+        bucket++;
+    }
+    stats->latency_hist[bucket]++;
+
+    stats->count++;
+}
+
+int metal_irq_stats_get(int hartid, enum metal_irq_stats_source source, int id,
+                        struct metal_irq_stats *stats) {
+    struct metal_irq_stats *s = __metal_irq_stats_find(hartid, source, id);
+
+    if (s == NULL) {
+        return -1;
+    }
+    *stats = *s;
+    return 0;
+}
+
+void metal_irq_stats_reset(void) {
+    memset(__metal_irq_stats, 0, sizeof(__metal_irq_stats));
+}
+
+void metal_irq_stats_dump(void) {
+    struct metal_irq_stats stats;
+
+    for (int hartid = 0; hartid < __METAL_DT_MAX_HARTS; hartid++) {
+        for (int source = METAL_IRQ_STATS_CPU; source <= METAL_IRQ_STATS_CLIC;
+             source++) {
+            for (int id = 0; id < __metal_irq_stats_ids[source]; id++) {
+                if ((metal_irq_stats_get(hartid, source, id, &stats) != 0) ||
+                    (stats.count == 0)) {
+                    continue;
+                }
+                printf("hart %d %s %d: count %lu latency %lu/%lu/%lu "
+                       "run %lu/%lu/%lu\n",
+                       hartid, __metal_irq_stats_names[source], id,
+                       stats.count, stats.latency_min,
+                       (unsigned long)(stats.latency_total / stats.count),
+                       stats.latency_max, stats.run_min,
+                       (unsigned long)(stats.run_total / stats.count),
+                       stats.run_max);
+                printf("  latency histogram:");
+                for (int b = 0; b < METAL_IRQ_STATS_BUCKETS; b++) {
+                    printf(" %lu", stats.latency_hist[b]);
+                }
+                printf("\n");
+            }
+        }
+    }
+}
+
+#else /* METAL_IRQ_STATS */
+
+int metal_irq_stats_get(int hartid, enum metal_irq_stats_source source, int id,
+                        struct metal_irq_stats *stats) {
+    return -1;
+}
+
+void metal_irq_stats_reset(void) {}
+
+void metal_irq_stats_dump(void) {}
+
+#endif /* METAL_IRQ_STATS */
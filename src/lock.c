@@ -2,7 +2,51 @@
 /* SPDX-License-Identifier: Apache-2.0 */
 
 #include <metal/lock.h>
+#include <metal/time.h>
 
 extern __inline__ int metal_lock_init(struct metal_lock *lock);
 extern __inline__ int metal_lock_take(struct metal_lock *lock);
+extern __inline__ int metal_lock_try_take(struct metal_lock *lock);
 extern __inline__ int metal_lock_give(struct metal_lock *lock);
+extern __inline__ int metal_ticket_lock_init(struct metal_ticket_lock *lock);
+extern __inline__ int metal_ticket_lock_take(struct metal_ticket_lock *lock);
+extern __inline__ int metal_ticket_lock_give(struct metal_ticket_lock *lock);
+extern __inline__ int metal_mcs_lock_init(struct metal_mcs_lock *lock);
+extern __inline__ int metal_mcs_lock_take(struct metal_mcs_lock *lock);
+extern __inline__ int metal_mcs_lock_give(struct metal_mcs_lock *lock);
+extern __inline__ int metal_rwlock_init(struct metal_rwlock *lock);
+extern __inline__ int metal_rwlock_read_take(struct metal_rwlock *lock);
+extern __inline__ int metal_rwlock_read_give(struct metal_rwlock *lock);
+extern __inline__ int metal_rwlock_write_take(struct metal_rwlock *lock);
+extern __inline__ int metal_rwlock_write_give(struct metal_rwlock *lock);
+extern __inline__ int metal_seqlock_init(struct metal_seqlock *lock);
+extern __inline__ int metal_seqlock_write_begin(struct metal_seqlock *lock);
+extern __inline__ int metal_seqlock_write_end(struct metal_seqlock *lock);
+extern __inline__ unsigned int
+metal_seqlock_read_begin(struct metal_seqlock *lock);
+extern __inline__ int metal_seqlock_read_retry(struct metal_seqlock *lock,
+                                               unsigned int seq);
+
+int metal_lock_take_timeout(struct metal_lock *lock, unsigned long timeout_us) {
+    struct metal_deadline deadline;
+    int backoff = 1;
+    const int max_backoff = METAL_LOCK_BACKOFF_CYCLES * METAL_MAX_CORES;
+
+    metal_deadline_init_us(&deadline, timeout_us);
+
+    while (metal_lock_try_take(lock) != 0) {
+        if (metal_deadline_expired(&deadline)) {
+            return -1;
+        }
+
+        for (int i = 0; i < backoff; i++) {
+            __asm__ volatile("");
+        }
+
+        if (backoff < max_backoff) {
+            backoff *= METAL_LOCK_BACKOFF_EXPONENT;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,294 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/atomic.h>
+#include <metal/cpu.h>
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/interrupt.h>
+#include <metal/machine.h>
+#include <metal/mailbox.h>
+
+#define METAL_HART_MAILBOX_MASK (METAL_HART_MAILBOX_DEPTH - 1)
+
+/* The type of the messages sent by metal_hart_call(), which the mailbox
+ * handles itself */
+#define METAL_HART_MESSAGE_CALL (-1)
+
+/*
+ * Each mailbox is a bounded multi-producer, single-consumer queue. Senders
+ * claim a position by advancing _tail, and every slot carries a sequence
+ * number which says whether it is free for the sender of position pos
+ * (seq == pos) or holds the message for the receiver of position pos
+ * (seq == pos + 1). The stored value is offset by the slot index so that a
+ * zeroed mailbox starts out with every slot free.
+ */
+struct __metal_hart_mailbox {
+    volatile unsigned int _tail;
+    unsigned int _head;
+    volatile int _listening;
+    metal_hart_message_handler_t _handler;
+    struct {
+        volatile unsigned int _seq;
+        struct metal_hart_message _message;
+        /* Only used by METAL_HART_MESSAGE_CALL */
+        metal_hart_call_fn_t _fn;
+        metal_atomic_t *_done;
+    } _slot[METAL_HART_MAILBOX_DEPTH];
+} __attribute__((aligned(64)));
+
+static struct __metal_hart_mailbox __metal_hart_mailbox[__METAL_DT_MAX_HARTS];
+
+static void __metal_hart_call_complete(metal_atomic_t *done) {
+#ifdef __riscv_atomic
+    metal_atomic_add(done, 1);
+#else
+    (*done)++;
+#endif
+}
+
+static unsigned int __metal_hart_mailbox_seq(struct __metal_hart_mailbox *mb,
+                                             unsigned int pos) {
+    unsigned int i = pos & METAL_HART_MAILBOX_MASK;
+
+    return mb->_slot[i]._seq + i;
+}
+
+/* Advance the tail from pos to pos + 1, failing if another sender got there
+ * first */
+static int __metal_hart_mailbox_claim(struct __metal_hart_mailbox *mb,
+                                      unsigned int pos) {
+#ifdef __riscv_atomic
+    unsigned int tail;
+    int fail;
+
+    __asm__ volatile("1: lr.w %[tail], (%[addr])\n"
+                     "   bne %[tail], %[pos], 2f\n"
+                     "   sc.w %[fail], %[next], (%[addr])\n"
+                     "   bnez %[fail], 1b\n"
+                     "2:"
+                     : [tail] "=&r"(tail), [fail] "=&r"(fail)
+                     : [addr] "r"(&mb->_tail), [pos] "r"(pos),
+                       [next] "r"(pos + 1)
+                     : "memory");
+    return tail == pos;
+#else
+    unsigned long mstatus;
+    int claimed = 0;
+
+    /* Without atomics only interrupt handlers on this hart can race */
+    __asm__ volatile("csrrc %0, mstatus, %1"
+                     : "=r"(mstatus)
+                     : "r"(METAL_MSTATUS_MIE));
+    if (mb->_tail == pos) {
+        mb->_tail = pos + 1;
+        claimed = 1;
+    }
+    __asm__ volatile("csrs mstatus, %0" ::"r"(mstatus & METAL_MSTATUS_MIE));
+    return claimed;
+#endif
+}
+
+int metal_hart_mailbox_listen(metal_hart_message_handler_t handler) {
+    int hartid = metal_cpu_get_current_hartid();
+    struct metal_cpu *cpu = metal_cpu_get(hartid);
+    struct metal_interrupt *sw_intc;
+
+    if ((cpu == NULL) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return -1;
+    }
+    sw_intc = metal_cpu_software_interrupt_controller(cpu);
+    if (sw_intc == NULL) {
+        return -1;
+    }
+
+    __metal_hart_mailbox[hartid]._handler = handler;
+    __metal_hart_mailbox[hartid]._listening = 1;
+    __asm__ volatile("fence rw, rw" ::: "memory");
+
+    metal_interrupt_init(sw_intc);
+    if (metal_interrupt_enable(sw_intc,
+                               metal_cpu_software_get_interrupt_id(cpu)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int __metal_hart_post(int hartid, int type, void *data,
+                             metal_hart_call_fn_t fn, metal_atomic_t *done) {
+    struct __metal_hart_mailbox *mb;
+    unsigned int pos;
+    int diff;
+
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return -1;
+    }
+    mb = &__metal_hart_mailbox[hartid];
+    if (!mb->_listening) {
+        return -1;
+    }
+
+    pos = mb->_tail;
+    while (1) {
+        diff = (int)(__metal_hart_mailbox_seq(mb, pos) - pos);
+        if (diff == 0) {
+            if (__metal_hart_mailbox_claim(mb, pos)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The slot still holds a message from the previous lap */
+            return -2;
+        }
+        pos = mb->_tail;
+    }
+
+    unsigned int i = pos & METAL_HART_MAILBOX_MASK;
+    mb->_slot[i]._message.sender = metal_cpu_get_current_hartid();
+    mb->_slot[i]._message.type = type;
+    mb->_slot[i]._message.data = data;
+    mb->_slot[i]._fn = fn;
+    mb->_slot[i]._done = done;
+
+    /* Publish the message, then make sure it is visible before the
+     * interrupt */
+    __asm__ volatile("fence rw, w" ::: "memory");
+    mb->_slot[i]._seq = pos + 1 - i;
+    __asm__ volatile("fence w, o" ::: "memory");
+
+    metal_cpu_software_set_ipi(metal_cpu_get(hartid), hartid);
+    return 0;
+}
+
+int metal_hart_send(int hartid, int type, void *data) {
+    if (type < 0) {
+        return -1;
+    }
+    return __metal_hart_post(hartid, type, data, NULL, NULL);
+}
+
+int metal_hart_mailbox_service(void) {
+    int hartid = metal_cpu_get_current_hartid();
+    struct __metal_hart_mailbox *mb;
+    int delivered = 0;
+
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS) ||
+        !__metal_hart_mailbox[hartid]._listening) {
+        return -1;
+    }
+    mb = &__metal_hart_mailbox[hartid];
+
+    /* Clear the interrupt first, so that a message which arrives after the
+     * queue is found empty raises it again */
+    metal_cpu_software_clear_ipi(metal_cpu_get(hartid), hartid);
+    __asm__ volatile("fence o, r" ::: "memory");
+
+    while (1) {
+        unsigned int pos = mb->_head;
+        unsigned int i = pos & METAL_HART_MAILBOX_MASK;
+        struct metal_hart_message message;
+        metal_hart_call_fn_t fn;
+        metal_atomic_t *done;
+
+        if (__metal_hart_mailbox_seq(mb, pos) != pos + 1) {
+            /* Empty, or the next sender hasn't finished writing */
+            break;
+        }
+        __asm__ volatile("fence r, rw" ::: "memory");
+        message = mb->_slot[i]._message;
+        fn = mb->_slot[i]._fn;
+        done = mb->_slot[i]._done;
+
+        /* Hand the slot back to the senders for the next lap */
+        __asm__ volatile("fence rw, w" ::: "memory");
+        mb->_slot[i]._seq = pos + METAL_HART_MAILBOX_DEPTH - i;
+        mb->_head = pos + 1;
+
+        if (message.type == METAL_HART_MESSAGE_CALL) {
+            fn(message.data);
+            if (done) {
+                __asm__ volatile("fence rw, rw" ::: "memory");
+                __metal_hart_call_complete(done);
+            }
+        } else if (mb->_handler) {
+            mb->_handler(&message);
+        }
+        delivered++;
+    }
+
+    return delivered;
+}
+
+/* Deliver our own messages while busy waiting on other harts. The software
+ * interrupt is held off meanwhile so that the handler can't deliver the same
+ * message again underneath us. */
+static void __metal_hart_mailbox_poll(void) {
+    unsigned long mstatus;
+
+    __asm__ volatile("csrrc %0, mstatus, %1"
+                     : "=r"(mstatus)
+                     : "r"(METAL_MSTATUS_MIE));
+    metal_hart_mailbox_service();
+    __asm__ volatile("csrs mstatus, %0" ::"r"(mstatus & METAL_MSTATUS_MIE));
+}
+
+int metal_hart_call_async(unsigned long hartmask, metal_hart_call_fn_t fn,
+                          void *arg, metal_atomic_t *done) {
+    int self = metal_cpu_get_current_hartid();
+    int rc = 0;
+
+    /* Queue the call on every other hart before running it here, so that
+     * they all run in parallel */
+    for (int hart = 0; hart < __METAL_DT_MAX_HARTS; hart++) {
+        if (!(hartmask & (1UL << hart)) || (hart == self)) {
+            continue;
+        }
+
+        int sent;
+        while ((sent = __metal_hart_post(hart, METAL_HART_MESSAGE_CALL, arg,
+                                         fn, done)) == -2) {
+            /* The mailbox is full. The target may itself be waiting on this
+             * hart, so keep delivering our own messages meanwhile. */
+            __metal_hart_mailbox_poll();
+        }
+        if (sent != 0) {
+            rc = -1;
+        }
+    }
+
+    if ((self >= 0) && (self < __METAL_DT_MAX_HARTS) &&
+        (hartmask & (1UL << self))) {
+        fn(arg);
+        if (done) {
+            __metal_hart_call_complete(done);
+        }
+    }
+
+    return rc;
+}
+
+int metal_hart_call(unsigned long hartmask, metal_hart_call_fn_t fn, void *arg,
+                    int wait) {
+    metal_atomic_t done = 0;
+    int expected = 0;
+    int rc;
+
+    if (!wait) {
+        return metal_hart_call_async(hartmask, fn, arg, NULL);
+    }
+
+    for (int hart = 0; hart < __METAL_DT_MAX_HARTS; hart++) {
+        if ((hartmask & (1UL << hart)) &&
+            ((hart == metal_cpu_get_current_hartid()) ||
+             __metal_hart_mailbox[hart]._listening)) {
+            expected++;
+        }
+    }
+
+    rc = metal_hart_call_async(hartmask, fn, arg, &done);
+
+    while (done < expected) {
+        __metal_hart_mailbox_poll();
+    }
+    __asm__ volatile("fence r, rw" ::: "memory");
+
+    return rc;
+}
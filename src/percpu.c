@@ -0,0 +1,6 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/percpu.h>
+
+extern __inline__ uintptr_t __metal_percpu_offset(void);
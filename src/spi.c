@@ -9,9 +9,20 @@ extern __inline__ int metal_spi_transfer(struct metal_spi *spi,
                                          struct metal_spi_config *config,
                                          size_t len, char *tx_buf,
                                          char *rx_buf);
+extern __inline__ int metal_spi_transfer_async(struct metal_spi *spi,
+                                               struct metal_spi_config *config,
+                                               size_t len, char *tx_buf,
+                                               char *rx_buf,
+                                               metal_spi_callback_t callback,
+                                               void *priv);
 extern __inline__ int metal_spi_get_baud_rate(struct metal_spi *spi);
 extern __inline__ int metal_spi_set_baud_rate(struct metal_spi *spi,
                                               int baud_rate);
+extern __inline__ int
+metal_spi_set_flash_format(struct metal_spi *spi,
+                           struct metal_spi_flash_format *format);
+extern __inline__ int metal_spi_set_flash_mapped(struct metal_spi *spi,
+                                                 int enable);
 
 struct metal_spi *metal_spi_get_device(unsigned int device_num) {
 #if __METAL_DT_MAX_SPIS > 0
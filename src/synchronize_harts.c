@@ -1,6 +1,7 @@
 /* Copyright 2019 SiFive, Inc */
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <metal/boot_log.h>
 #include <metal/cpu.h>
 #include <metal/io.h>
 #include <metal/machine.h>
@@ -63,4 +64,6 @@ __attribute__((section(".init"))) void __metal_synchronize_harts() {
     }
 
 #endif /* __METAL_DT_MAX_HARTS > 1 */
+
+    __METAL_BOOT_LOG(METAL_BOOT_LOG_SYNC_HARTS, NULL);
 }
@@ -0,0 +1,417 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/cpu.h>
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/machine.h>
+#include <metal/thread.h>
+#include <metal/timer.h>
+#include <string.h>
+
+extern __inline__ int metal_thread_mutex_init(struct metal_thread_mutex *mutex);
+extern __inline__ void
+metal_thread_mutex_lock(struct metal_thread_mutex *mutex);
+extern __inline__ void
+metal_thread_mutex_unlock(struct metal_thread_mutex *mutex);
+
+#define METAL_THREAD_READY 0
+#define METAL_THREAD_RUNNING 1
+#define METAL_THREAD_BLOCKED 2
+#define METAL_THREAD_EXITED 3
+/* Exited, but still running on its stack until the hart switches away */
+#define METAL_THREAD_EXITING 4
+
+/* The context saved by __metal_thread_switch() in thread_switch.S, in
+ * registers. A new thread starts with a zeroed context which returns to
+ * __metal_thread_start(). */
+#define METAL_THREAD_CONTEXT_RA 0
+#define METAL_THREAD_CONTEXT_MSTATUS 14
+#define METAL_THREAD_CONTEXT_INT (16 * sizeof(uintptr_t))
+#ifdef __riscv_flen
+#define METAL_THREAD_CONTEXT_SIZE                                              \
+    ((METAL_THREAD_CONTEXT_INT + 12 * (__riscv_flen / 8) + sizeof(uintptr_t) + \
+      15) &                                                                    \
+     ~15UL)
+#else
+#define METAL_THREAD_CONTEXT_SIZE METAL_THREAD_CONTEXT_INT
+#endif
+
+void __metal_thread_switch(uintptr_t *save_sp, uintptr_t next_sp);
+
+struct __metal_thread_hart {
+    /* Taken with interrupts disabled, since other harts make threads ready */
+    struct metal_lock _lock;
+    int _ready;
+    struct metal_thread *_current;
+    struct metal_thread *_head;
+    struct metal_thread *_tail;
+    /* The thread which was running when the hart first used the API */
+    struct metal_thread _main;
+    /* Set while the hart waits for a thread to become ready */
+    int _idle;
+    /* The exited thread whose stack the hart is still using */
+    struct metal_thread *_exiting;
+    volatile int _need_resched;
+    unsigned long long _slice;
+    unsigned long long _slice_deadline;
+    struct metal_timer _slice_timer;
+} __attribute__((aligned(64)));
+
+static struct __metal_thread_hart __metal_thread_hart[__METAL_DT_MAX_HARTS];
+
+static unsigned long __metal_thread_irq_save(void) {
+    unsigned long mstatus;
+
+    __asm__ volatile("csrrc %0, mstatus, %1"
+                     : "=r"(mstatus)
+                     : "r"(METAL_MSTATUS_MIE));
+    return mstatus;
+}
+
+static void __metal_thread_irq_restore(unsigned long mstatus) {
+    __asm__ volatile("csrs mstatus, %0" ::"r"(mstatus & METAL_MSTATUS_MIE));
+}
+
+/* Without atomics, disabling interrupts is all the protection there is */
+static void __metal_thread_lock(struct metal_lock *lock) {
+#ifdef __riscv_atomic
+    metal_lock_take(lock);
+#endif
+}
+
+static void __metal_thread_unlock(struct metal_lock *lock) {
+#ifdef __riscv_atomic
+    metal_lock_give(lock);
+#endif
+}
+
+static struct __metal_thread_hart *__metal_thread_hart_get(void) {
+    int hartid = metal_cpu_get_current_hartid();
+    struct __metal_thread_hart *hart;
+
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return NULL;
+    }
+    hart = &__metal_thread_hart[hartid];
+
+    if (!hart->_ready) {
+#ifdef __riscv_atomic
+        if (metal_lock_init(&hart->_lock) != 0) {
+            return NULL;
+        }
+#endif
+        hart->_main._state = METAL_THREAD_RUNNING;
+        hart->_main._hartid = hartid;
+        hart->_current = &hart->_main;
+        hart->_ready = 1;
+    }
+    return hart;
+}
+
+/* Must be called with the run queue locked */
+static void __metal_thread_enqueue(struct __metal_thread_hart *hart,
+                                   struct metal_thread *thread) {
+    thread->_state = METAL_THREAD_READY;
+    thread->_next = NULL;
+    if (hart->_tail) {
+        hart->_tail->_next = thread;
+    } else {
+        hart->_head = thread;
+    }
+    hart->_tail = thread;
+}
+
+/* Once the hart runs on another stack, the thread which exited is done with
+ * its own. Called by every thread the scheduler switches to, with interrupts
+ * disabled. */
+static void __metal_thread_reap(struct __metal_thread_hart *hart) {
+    if (hart->_exiting && (hart->_exiting != hart->_current)) {
+        /* Another hart may reuse the stack as soon as it sees this */
+        __asm__ volatile("fence rw, w" ::: "memory");
+        hart->_exiting->_state = METAL_THREAD_EXITED;
+        hart->_exiting = NULL;
+    }
+}
+
+/* Switch to the next ready thread of the hart. The current thread goes back
+ * on the run queue if it is still running, and otherwise stays off it until
+ * it is made ready. Must be called with interrupts disabled. */
+static void __metal_thread_schedule(struct __metal_thread_hart *hart) {
+    struct metal_thread *prev = hart->_current;
+    struct metal_thread *next;
+
+    __metal_thread_lock(&hart->_lock);
+    if (prev->_state == METAL_THREAD_RUNNING) {
+        __metal_thread_enqueue(hart, prev);
+    }
+
+    while ((next = hart->_head) == NULL) {
+        /* Wait for an interrupt to make a thread ready. wfi returns on a
+         * pending interrupt even with MIE clear, so none is missed between
+         * the check and the wait. */
+        __metal_thread_unlock(&hart->_lock);
+        hart->_idle = 1;
+        __asm__ volatile("wfi");
+        __asm__ volatile("csrs mstatus, %0" ::"r"(METAL_MSTATUS_MIE));
+        __asm__ volatile("csrc mstatus, %0" ::"r"(METAL_MSTATUS_MIE));
+        hart->_idle = 0;
+        __metal_thread_lock(&hart->_lock);
+    }
+
+    hart->_head = next->_next;
+    if (hart->_head == NULL) {
+        hart->_tail = NULL;
+    }
+    next->_state = METAL_THREAD_RUNNING;
+    hart->_current = next;
+    __metal_thread_unlock(&hart->_lock);
+
+    if (next != prev) {
+        __metal_thread_switch(&prev->_sp, next->_sp);
+        __metal_thread_reap(hart);
+    }
+}
+
+/* Put a blocked thread back on the run queue of its hart, from any hart.
+ * Must be called with interrupts disabled. */
+static void __metal_thread_wake(struct metal_thread *thread) {
+    struct __metal_thread_hart *hart = &__metal_thread_hart[thread->_hartid];
+
+    __metal_thread_lock(&hart->_lock);
+    __metal_thread_enqueue(hart, thread);
+    __metal_thread_unlock(&hart->_lock);
+}
+
+static void __metal_thread_start(void) {
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+    struct metal_thread *self = hart->_current;
+    unsigned long mstatus;
+
+    mstatus = __metal_thread_irq_save();
+    __metal_thread_reap(hart);
+    __metal_thread_irq_restore(mstatus);
+
+    self->_entry(self->_arg);
+    metal_thread_exit();
+}
+
+int metal_thread_create(struct metal_thread *thread, metal_thread_entry_t entry,
+                        void *arg, void *stack, size_t stack_size) {
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+    uintptr_t top = ((uintptr_t)stack + stack_size) & ~15UL;
+    uintptr_t *context;
+    unsigned long mstatus;
+
+    if ((hart == NULL) || (stack_size < METAL_THREAD_CONTEXT_SIZE + 16)) {
+        return -1;
+    }
+
+    context = (uintptr_t *)(top - METAL_THREAD_CONTEXT_SIZE);
+    memset(context, 0, METAL_THREAD_CONTEXT_SIZE);
+    context[METAL_THREAD_CONTEXT_RA] = (uintptr_t)__metal_thread_start;
+    __asm__ volatile("csrr %0, mstatus" : "=r"(mstatus));
+    context[METAL_THREAD_CONTEXT_MSTATUS] = mstatus | METAL_MSTATUS_MIE;
+
+    thread->_sp = (uintptr_t)context;
+    thread->_entry = entry;
+    thread->_arg = arg;
+    thread->_hartid = hart->_main._hartid;
+
+    mstatus = __metal_thread_irq_save();
+    __metal_thread_lock(&hart->_lock);
+    __metal_thread_enqueue(hart, thread);
+    __metal_thread_unlock(&hart->_lock);
+    __metal_thread_irq_restore(mstatus);
+
+    return 0;
+}
+
+struct metal_thread *metal_thread_self(void) {
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+
+    if (hart == NULL) {
+        return NULL;
+    }
+    return hart->_current;
+}
+
+int metal_thread_exited(struct metal_thread *thread) {
+    return thread->_state == METAL_THREAD_EXITED;
+}
+
+void metal_thread_yield(void) {
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+    unsigned long mstatus;
+
+    if (hart == NULL) {
+        return;
+    }
+
+    mstatus = __metal_thread_irq_save();
+    __metal_thread_schedule(hart);
+    __metal_thread_irq_restore(mstatus);
+}
+
+void metal_thread_exit(void) {
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+
+    __metal_thread_irq_save();
+    if (hart) {
+        /* The stack stays in use, by the scheduler and by the interrupts
+         * it waits for, until another thread of the hart runs */
+        hart->_current->_state = METAL_THREAD_EXITING;
+        hart->_exiting = hart->_current;
+        __metal_thread_schedule(hart);
+    }
+    /* Not reached unless the hart can't run threads */
+    while (1) {
+        __asm__ volatile("wfi");
+    }
+}
+
+static void __metal_thread_slice_end(struct metal_timer *timer, void *data) {
+    struct __metal_thread_hart *hart = data;
+    unsigned long long now = metal_mtime_read();
+
+    hart->_need_resched = 1;
+
+    /* Keep the slices on a fixed period, unless interrupts were held off
+     * for longer than a slice */
+    hart->_slice_deadline += hart->_slice;
+    if (hart->_slice_deadline <= now) {
+        hart->_slice_deadline = now + hart->_slice;
+    }
+    metal_timer_modify(timer, hart->_slice_deadline);
+}
+
+int metal_thread_preempt_start(unsigned long long slice) {
+    /* Only the CLINT interrupt handlers of riscv_cpu.c switch threads */
+#ifdef __METAL_DT_RISCV_CLINT0_HANDLE
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+
+    if ((hart == NULL) || (slice == 0)) {
+        return -1;
+    }
+
+    /* Restart the slice timer if it is already running */
+    if (metal_timer_cancel(&hart->_slice_timer) < 0) {
+        return -1;
+    }
+    hart->_slice = slice;
+    hart->_slice_deadline = metal_mtime_read() + slice;
+    if (metal_timer_add(&hart->_slice_timer, hart->_slice_deadline,
+                        __metal_thread_slice_end, hart) != 0) {
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* Called by the interrupt handlers of riscv_cpu.c once the interrupt has
+ * been handled, with interrupts disabled */
+void __metal_thread_preempt(void) {
+    int hartid = metal_cpu_get_current_hartid();
+    struct __metal_thread_hart *hart;
+
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return;
+    }
+    hart = &__metal_thread_hart[hartid];
+
+    /* An idle hart is already in the scheduler, which picks up the threads
+     * the interrupt made ready when it returns */
+    if (!hart->_ready || !hart->_need_resched || hart->_idle) {
+        return;
+    }
+    hart->_need_resched = 0;
+    __metal_thread_schedule(hart);
+}
+
+int metal_thread_sem_init(struct metal_thread_sem *sem, int count) {
+    sem->_count = count;
+    sem->_head = NULL;
+    sem->_tail = NULL;
+#ifdef __riscv_atomic
+    return metal_lock_init(&sem->_lock);
+#else
+    return 0;
+#endif
+}
+
+void metal_thread_sem_wait(struct metal_thread_sem *sem) {
+    struct __metal_thread_hart *hart = __metal_thread_hart_get();
+    struct metal_thread *self;
+    unsigned long mstatus;
+
+    if (hart == NULL) {
+        /* No thread to block, so wait for the count to rise */
+        while (metal_thread_sem_trywait(sem) != 0) {
+        }
+        return;
+    }
+
+    mstatus = __metal_thread_irq_save();
+    __metal_thread_lock(&sem->_lock);
+    if (sem->_count > 0) {
+        sem->_count--;
+        __metal_thread_unlock(&sem->_lock);
+        __metal_thread_irq_restore(mstatus);
+        return;
+    }
+
+    self = hart->_current;
+    self->_state = METAL_THREAD_BLOCKED;
+    self->_next = NULL;
+    if (sem->_tail) {
+        sem->_tail->_next = self;
+    } else {
+        sem->_head = self;
+    }
+    sem->_tail = self;
+    __metal_thread_unlock(&sem->_lock);
+
+    /* The post which wakes us hands the count over directly */
+    __metal_thread_schedule(hart);
+    __metal_thread_irq_restore(mstatus);
+}
+
+int metal_thread_sem_trywait(struct metal_thread_sem *sem) {
+    unsigned long mstatus;
+    int rc = -1;
+
+    mstatus = __metal_thread_irq_save();
+    __metal_thread_lock(&sem->_lock);
+    if (sem->_count > 0) {
+        sem->_count--;
+        rc = 0;
+    }
+    __metal_thread_unlock(&sem->_lock);
+    __metal_thread_irq_restore(mstatus);
+
+    return rc;
+}
+
+void metal_thread_sem_post(struct metal_thread_sem *sem) {
+    struct metal_thread *waiter;
+    unsigned long mstatus;
+
+    mstatus = __metal_thread_irq_save();
+    __metal_thread_lock(&sem->_lock);
+    waiter = sem->_head;
+    if (waiter) {
+        sem->_head = waiter->_next;
+        if (sem->_head == NULL) {
+            sem->_tail = NULL;
+        }
+    } else {
+        sem->_count++;
+    }
+    __metal_thread_unlock(&sem->_lock);
+
+    if (waiter) {
+        __metal_thread_wake(waiter);
+    }
+    __metal_thread_irq_restore(mstatus);
+}
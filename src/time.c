@@ -1,22 +1,79 @@
 /* Copyright 2019 SiFive, Inc */
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <metal/cpu.h>
 #include <metal/time.h>
 #include <metal/timer.h>
 
+/* Waits shorter than this many ticks of mtime poll it instead of arming a
+ * timer, since the interrupt would arrive about as soon */
+#ifndef METAL_DELAY_SPIN_TICKS
+#define METAL_DELAY_SPIN_TICKS 2
+#endif
+
+extern __inline__ unsigned long long
+__metal_time_mulhi(unsigned long long a, unsigned long long b);
+extern __inline__ unsigned long long
+metal_time_scale_split(const struct metal_time_scale *scale,
+                       unsigned long long ticks, unsigned long long *frac);
+extern __inline__ unsigned long
+metal_time_scale_ns(const struct metal_time_scale *scale,
+                    unsigned long long frac);
+extern __inline__ unsigned long long
+metal_time_scale_ticks(const struct metal_time_scale *scale,
+                       unsigned long long sec, unsigned long ns);
+
+int metal_time_scale_init(struct metal_time_scale *scale,
+                          unsigned long long hz) {
+    if (hz == 0) {
+        return -1;
+    }
+    scale->_recip = ~0ULL / hz;
+    scale->_ns_mult = (1000000000ULL << 32) / hz;
+    /* Rounded up so that waits are never short, and split so that hz << 32
+     * can't overflow */
+    scale->_tick_mult =
+        ((hz / 1000000000) << 32) +
+        (((hz % 1000000000) << 32) + 1000000000 - 1) / 1000000000;
+    /* Publish the rate last, since readers check it before the factors */
+    __asm__ volatile("fence w, w" ::: "memory");
+    scale->hz = hz;
+    return 0;
+}
+
+static struct metal_time_scale __metal_time_scale_timebase;
+
+const struct metal_time_scale *metal_time_scale_timebase(void) {
+    struct metal_time_scale *scale = &__metal_time_scale_timebase;
+    unsigned long long timebase;
+
+    if (metal_timer_get_timebase_frequency(0, &timebase) != 0) {
+        return NULL;
+    }
+    /* Only divide when the timebase changes */
+    if (*(volatile unsigned long long *)&scale->hz != timebase) {
+        if (metal_time_scale_init(scale, timebase) != 0) {
+            return NULL;
+        }
+    }
+    __asm__ volatile("fence r, r" ::: "memory");
+    return scale;
+}
+
 int metal_gettimeofday(struct timeval *tp, void *tzp) {
     int rv;
-    unsigned long long mcc, timebase;
+    unsigned long long mcc, frac;
+    const struct metal_time_scale *scale;
     rv = metal_timer_get_cyclecount(0, &mcc);
     if (rv != 0) {
         return -1;
     }
-    rv = metal_timer_get_timebase_frequency(0, &timebase);
-    if (rv != 0) {
+    scale = metal_time_scale_timebase();
+    if (scale == NULL) {
         return -1;
     }
-    tp->tv_sec = mcc / timebase;
-    tp->tv_usec = mcc % timebase * 1000000 / timebase;
+    tp->tv_sec = metal_time_scale_split(scale, mcc, &frac);
+    tp->tv_usec = metal_time_scale_ns(scale, frac) / 1000;
     return 0;
 }
 
@@ -28,3 +85,67 @@ time_t metal_time(void) {
 
     return now.tv_sec;
 }
+
+extern __inline__ unsigned long long metal_deadline_now(void);
+extern __inline__ void metal_deadline_rearm(struct metal_deadline *deadline);
+extern __inline__ int
+metal_deadline_expired(const struct metal_deadline *deadline);
+
+unsigned long long metal_deadline_us_to_ticks(unsigned long us) {
+    unsigned long long timebase;
+
+    if (metal_timer_get_timebase_frequency(0, &timebase) != 0) {
+        return 0;
+    }
+    return (unsigned long long)us * timebase / 1000000;
+}
+
+void metal_deadline_init_us(struct metal_deadline *deadline, unsigned long us) {
+    deadline->ticks = metal_deadline_us_to_ticks(us);
+
+    /* Without a timebase there is no way to measure the timeout, so wait
+     * as long as the counter allows rather than failing immediately */
+    if (deadline->ticks == 0 && us != 0) {
+        deadline->ticks = ~0ULL >> 1;
+    }
+    metal_deadline_rearm(deadline);
+}
+
+static void __metal_delay_wake(struct metal_timer *timer, void *data) {}
+
+int metal_delay(unsigned long long sec, unsigned long ns) {
+    const struct metal_time_scale *scale = metal_time_scale_timebase();
+    struct metal_cpu *cpu = metal_cpu_get(metal_cpu_get_current_hartid());
+    struct metal_timer timer = {0};
+    unsigned long long ticks, deadline;
+
+    if ((scale == NULL) || (cpu == NULL) ||
+        (metal_cpu_timer_interrupt_controller(cpu) == NULL)) {
+        return -1;
+    }
+    ticks = metal_time_scale_ticks(scale, sec, ns);
+    deadline = metal_mtime_read() + ticks;
+
+    /* The timer only makes sure that mtimecmp wakes the hart in time. WFI
+     * also returns for any other interrupt, and when machine interrupts are
+     * disabled it keeps returning while an interrupt is pending, so the loop
+     * checks mtime itself. The wheel is only used if it already owns
+     * mtimecmp, since starting it would take the timer interrupt away from
+     * an application which programs mtimecmp itself. */
+    if ((ticks >= METAL_DELAY_SPIN_TICKS) &&
+        __metal_timer_wheel_active(metal_cpu_get_current_hartid()) &&
+        (metal_timer_add(&timer, deadline, __metal_delay_wake, NULL) == 0)) {
+        while (metal_mtime_read() < deadline) {
+            __asm__ volatile("wfi");
+        }
+        metal_timer_cancel(&timer);
+    } else {
+        while (metal_mtime_read() < deadline) {
+        }
+    }
+    return 0;
+}
+
+int metal_delay_us(unsigned long us) {
+    return metal_delay(us / 1000000, (us % 1000000) * 1000);
+}
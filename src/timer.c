@@ -7,6 +7,9 @@
 #include <sys/time.h>
 #include <sys/times.h>
 
+extern __inline__ unsigned long long __metal_mtime_read_mmio(uintptr_t addr);
+extern __inline__ unsigned long long metal_mtime_read(void);
+
 #if defined(__METAL_DT_MAX_HARTS)
 /* This implementation serves as a small shim that interfaces with the first
  * timer on a system. */
@@ -0,0 +1,312 @@
+/* Copyright 2020 SiFive, Inc */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <metal/cpu.h>
+#include <metal/drivers/riscv_cpu.h>
+#include <metal/interrupt.h>
+#include <metal/machine.h>
+#include <metal/timer.h>
+#include <stdint.h>
+
+/* The wheel has one slot per 2^METAL_TIMER_WHEEL_SHIFT ticks of mtime. The
+ * slot width only trades the length of the slot lists against how far ahead
+ * the wheel reaches, since mtimecmp is always programmed with the exact
+ * deadline. */
+#ifndef METAL_TIMER_WHEEL_SHIFT
+#define METAL_TIMER_WHEEL_SHIFT 8
+#endif
+
+/* One bit per slot in the occupancy mask */
+#define METAL_TIMER_WHEEL_SLOTS 64
+#define METAL_TIMER_WHEEL_MASK (METAL_TIMER_WHEEL_SLOTS - 1)
+
+#define METAL_TIMER_NEVER (~0ULL)
+
+/*
+ * Timers are hashed into slots by their deadline, with no ordering inside a
+ * slot, so adding and removing a timer is O(1). A slot holds every timer
+ * whose deadline falls in it on any lap of the wheel. Timers whose deadline
+ * was already processed when they were added go in the slot of the current
+ * time instead, so that the next run of the wheel finds them.
+ */
+struct __metal_timer_wheel {
+    struct metal_cpu *_cpu;
+    /* The value of mtime up to which the timers have run */
+    unsigned long long _processed;
+    /* The deadline mtimecmp is programmed with */
+    unsigned long long _armed;
+    uint64_t _occupied;
+    struct metal_timer *_slot[METAL_TIMER_WHEEL_SLOTS];
+};
+
+static struct __metal_timer_wheel __metal_timer_wheel[__METAL_DT_MAX_HARTS];
+
+static unsigned long __metal_timer_irq_save(void) {
+    unsigned long mstatus;
+
+    __asm__ volatile("csrrc %0, mstatus, %1"
+                     : "=r"(mstatus)
+                     : "r"(METAL_MSTATUS_MIE));
+    return mstatus;
+}
+
+static void __metal_timer_irq_restore(unsigned long mstatus) {
+    __asm__ volatile("csrs mstatus, %0" ::"r"(mstatus & METAL_MSTATUS_MIE));
+}
+
+static struct __metal_timer_wheel *__metal_timer_wheel_get(int hartid) {
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS) ||
+        (__metal_timer_wheel[hartid]._cpu == NULL)) {
+        return NULL;
+    }
+    return &__metal_timer_wheel[hartid];
+}
+
+int __metal_timer_wheel_active(int hartid) {
+    return __metal_timer_wheel_get(hartid) != NULL;
+}
+
+static void __metal_timer_arm(struct __metal_timer_wheel *wheel,
+                              unsigned long long deadline) {
+    wheel->_armed = deadline;
+    metal_cpu_set_mtimecmp(wheel->_cpu, deadline);
+}
+
+static void __metal_timer_insert(struct __metal_timer_wheel *wheel,
+                                 struct metal_timer *timer) {
+    unsigned long long key = timer->_deadline;
+    int slot;
+
+    if (key < wheel->_processed) {
+        key = wheel->_processed;
+    }
+    slot = (key >> METAL_TIMER_WHEEL_SHIFT) & METAL_TIMER_WHEEL_MASK;
+
+    timer->_slot = slot;
+    timer->_next = wheel->_slot[slot];
+    if (timer->_next) {
+        timer->_next->_pprev = &timer->_next;
+    }
+    timer->_pprev = &wheel->_slot[slot];
+    wheel->_slot[slot] = timer;
+    wheel->_occupied |= (uint64_t)1 << slot;
+}
+
+/* Unlink a timer from its slot, or from the list of expired timers when its
+ * slot is -1 */
+static void __metal_timer_remove(struct __metal_timer_wheel *wheel,
+                                 struct metal_timer *timer) {
+    *timer->_pprev = timer->_next;
+    if (timer->_next) {
+        timer->_next->_pprev = timer->_pprev;
+    }
+    if ((timer->_slot >= 0) && (wheel->_slot[timer->_slot] == NULL)) {
+        wheel->_occupied &= ~((uint64_t)1 << timer->_slot);
+    }
+    timer->_pprev = NULL;
+}
+
+static unsigned long long __metal_timer_slot_min(struct metal_timer *timer) {
+    unsigned long long min = METAL_TIMER_NEVER;
+
+    for (; timer; timer = timer->_next) {
+        if (timer->_deadline < min) {
+            min = timer->_deadline;
+        }
+    }
+    return min;
+}
+
+/* Find the earliest deadline. Walk the occupied slots in the order the wheel
+ * reaches them: the first one holding a timer due on the current lap holds
+ * the earliest. Only when every timer is at least a lap away are all of the
+ * slots searched. */
+static unsigned long long
+__metal_timer_next_deadline(struct __metal_timer_wheel *wheel) {
+    unsigned long long base = wheel->_processed >> METAL_TIMER_WHEEL_SHIFT;
+    int first = base & METAL_TIMER_WHEEL_MASK;
+    uint64_t pending = wheel->_occupied;
+    unsigned long long min = METAL_TIMER_NEVER;
+
+    if (first != 0) {
+        pending = (pending >> first) |
+                  (pending << (METAL_TIMER_WHEEL_SLOTS - first));
+    }
+    while (pending) {
+        int distance = __builtin_ctzll(pending);
+        int slot = (first + distance) & METAL_TIMER_WHEEL_MASK;
+        unsigned long long deadline =
+            __metal_timer_slot_min(wheel->_slot[slot]);
+
+        if (deadline < ((base + distance + 1) << METAL_TIMER_WHEEL_SHIFT)) {
+            return deadline;
+        }
+        if (deadline < min) {
+            min = deadline;
+        }
+        pending &= pending - 1;
+    }
+    return min;
+}
+
+int metal_timer_add(struct metal_timer *timer, unsigned long long deadline,
+                    metal_timer_callback_t callback, void *data) {
+    int hartid = metal_cpu_get_current_hartid();
+    struct __metal_timer_wheel *wheel;
+    unsigned long mstatus;
+
+    if ((hartid < 0) || (hartid >= __METAL_DT_MAX_HARTS)) {
+        return -1;
+    }
+    wheel = &__metal_timer_wheel[hartid];
+
+    if (wheel->_cpu == NULL) {
+        struct metal_cpu *cpu = metal_cpu_get(hartid);
+        struct metal_interrupt *tmr_intc;
+
+        if (cpu == NULL) {
+            return -1;
+        }
+        tmr_intc = metal_cpu_timer_interrupt_controller(cpu);
+        if (tmr_intc == NULL) {
+            return -1;
+        }
+
+        wheel->_cpu = cpu;
+        wheel->_processed = metal_mtime_read();
+        __metal_timer_arm(wheel, METAL_TIMER_NEVER);
+
+        metal_interrupt_init(tmr_intc);
+        if (metal_interrupt_enable(tmr_intc,
+                                   metal_cpu_timer_get_interrupt_id(cpu)) !=
+            0) {
+            wheel->_cpu = NULL;
+            return -1;
+        }
+    }
+
+    mstatus = __metal_timer_irq_save();
+    if (timer->_pprev) {
+        __metal_timer_irq_restore(mstatus);
+        return -2;
+    }
+    timer->_deadline = deadline;
+    timer->_callback = callback;
+    timer->_data = data;
+    timer->_hartid = hartid;
+    __metal_timer_insert(wheel, timer);
+    /* Only touch mtimecmp when the earliest deadline moves */
+    if (deadline < wheel->_armed) {
+        __metal_timer_arm(wheel, deadline);
+    }
+    __metal_timer_irq_restore(mstatus);
+
+    return 0;
+}
+
+int metal_timer_cancel(struct metal_timer *timer) {
+    struct __metal_timer_wheel *wheel;
+    unsigned long mstatus;
+    int rc = 1;
+
+    if (timer->_pprev == NULL) {
+        return 1;
+    }
+    wheel = __metal_timer_wheel_get(metal_cpu_get_current_hartid());
+    if ((wheel == NULL) || (timer->_hartid != metal_cpu_get_current_hartid())) {
+        return -1;
+    }
+
+    /* mtimecmp is left alone: if this was the earliest timer, the interrupt
+     * finds nothing to run and programs the next deadline */
+    mstatus = __metal_timer_irq_save();
+    if (timer->_pprev) {
+        __metal_timer_remove(wheel, timer);
+        rc = 0;
+    }
+    __metal_timer_irq_restore(mstatus);
+
+    return rc;
+}
+
+int metal_timer_modify(struct metal_timer *timer, unsigned long long deadline) {
+    struct __metal_timer_wheel *wheel;
+    unsigned long mstatus;
+
+    wheel = __metal_timer_wheel_get(metal_cpu_get_current_hartid());
+    if ((wheel == NULL) || (timer->_callback == NULL) ||
+        (timer->_hartid != metal_cpu_get_current_hartid())) {
+        return -1;
+    }
+
+    mstatus = __metal_timer_irq_save();
+    if (timer->_pprev) {
+        __metal_timer_remove(wheel, timer);
+    }
+    timer->_deadline = deadline;
+    __metal_timer_insert(wheel, timer);
+    if (deadline < wheel->_armed) {
+        __metal_timer_arm(wheel, deadline);
+    }
+    __metal_timer_irq_restore(mstatus);
+
+    return 0;
+}
+
+int metal_timer_service(void) {
+    struct __metal_timer_wheel *wheel;
+    struct metal_timer *expired = NULL;
+    unsigned long long now, slot, last;
+    int count = 0;
+
+    wheel = __metal_timer_wheel_get(metal_cpu_get_current_hartid());
+    if (wheel == NULL) {
+        return -1;
+    }
+
+    now = metal_mtime_read();
+    slot = wheel->_processed >> METAL_TIMER_WHEEL_SHIFT;
+    last = now >> METAL_TIMER_WHEEL_SHIFT;
+    if (last - slot >= METAL_TIMER_WHEEL_SLOTS) {
+        slot = last - METAL_TIMER_WHEEL_MASK;
+    }
+    wheel->_processed = now;
+
+    /* Move every expired timer to a list of its own before running any
+     * callback, so that timers the callbacks add wait for the next interrupt.
+     * The expired timers stay pending until their callback runs, so the
+     * callbacks can still cancel or modify them. */
+    for (; slot <= last; slot++) {
+        struct metal_timer *timer;
+
+        timer = wheel->_slot[slot & METAL_TIMER_WHEEL_MASK];
+        while (timer) {
+            struct metal_timer *next = timer->_next;
+
+            if (timer->_deadline <= now) {
+                __metal_timer_remove(wheel, timer);
+                timer->_slot = -1;
+                timer->_next = expired;
+                if (expired) {
+                    expired->_pprev = &timer->_next;
+                }
+                timer->_pprev = &expired;
+                expired = timer;
+            }
+            timer = next;
+        }
+    }
+
+    while (expired) {
+        struct metal_timer *timer = expired;
+
+        __metal_timer_remove(wheel, timer);
+        timer->_callback(timer, timer->_data);
+        count++;
+    }
+
+    /* Writing mtimecmp also clears the pending interrupt */
+    __metal_timer_arm(wheel, __metal_timer_next_deadline(wheel));
+
+    return count;
+}
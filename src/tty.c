@@ -16,6 +16,24 @@ int metal_tty_putc(int c) {
     return metal_tty_putc_raw(c);
 }
 
+int metal_tty_write(const char *buf, size_t len) {
+    size_t start = 0;
+
+    /* Hand the UART runs of bytes between newlines, inserting a carriage
+     * return ahead of each newline */
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            metal_uart_write_buf(__METAL_DT_STDOUT_UART_HANDLE, buf + start,
+                                 i - start);
+            metal_uart_write_buf(__METAL_DT_STDOUT_UART_HANDLE, "\r", 1);
+            start = i;
+        }
+    }
+    metal_uart_write_buf(__METAL_DT_STDOUT_UART_HANDLE, buf + start,
+                         len - start);
+    return len;
+}
+
 int metal_tty_putc_raw(int c) {
     return metal_uart_putc(__METAL_DT_STDOUT_UART_HANDLE, c);
 }
@@ -42,6 +60,11 @@ int metal_tty_getc(int *c) {
 int nop_putc(int c) __attribute__((section(".text.metal.nop.putc")));
 int nop_putc(int c) { return -1; }
 int metal_tty_putc(int c) __attribute__((weak, alias("nop_putc")));
+int nop_write(const char *buf, size_t len)
+    __attribute__((section(".text.metal.nop.write")));
+int nop_write(const char *buf, size_t len) { return len; }
+int metal_tty_write(const char *buf, size_t len)
+    __attribute__((weak, alias("nop_write")));
 #pragma message(                                                               \
     "There is no default output device, metal_tty_putc() will throw away all input.")
 #endif
@@ -6,6 +6,8 @@
 
 extern __inline__ void metal_uart_init(struct metal_uart *uart, int baud_rate);
 extern __inline__ int metal_uart_putc(struct metal_uart *uart, int c);
+extern __inline__ int metal_uart_write_buf(struct metal_uart *uart,
+                                           const char *buf, size_t len);
 extern __inline__ int metal_uart_txready(struct metal_uart *uart);
 extern __inline__ int metal_uart_getc(struct metal_uart *uart, int *c);
 extern __inline__ int metal_uart_get_baud_rate(struct metal_uart *uart);
@@ -40,3 +42,56 @@ struct metal_uart *metal_uart_get_device(unsigned int device_num) {
 
     return NULL;
 }
+
+int metal_uart_set_buffers(struct metal_uart *uart, char *tx_buf,
+                           size_t tx_len, char *rx_buf, size_t rx_len) {
+    if (uart->vtable->set_buffers == NULL) {
+        return -1;
+    }
+    return uart->vtable->set_buffers(uart, tx_buf, tx_len, rx_buf, rx_len);
+}
+
+int metal_uart_write(struct metal_uart *uart, const char *buf, size_t len) {
+    if (uart->vtable->write != NULL) {
+        return uart->vtable->write(uart, buf, len);
+    }
+
+    /* Devices without a native write can only block */
+    if (uart->vtable->write_buf != NULL) {
+        if (metal_uart_write_buf(uart, buf, len) != 0) {
+            return -1;
+        }
+        return len;
+    }
+    for (size_t i = 0; i < len; i++) {
+        metal_uart_putc(uart, (unsigned char)buf[i]);
+    }
+    return len;
+}
+
+int metal_uart_read(struct metal_uart *uart, char *buf, size_t len) {
+    if (uart->vtable->read != NULL) {
+        return uart->vtable->read(uart, buf, len);
+    }
+    if (uart->vtable->getc == NULL) {
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+        int c = -1;
+        if (metal_uart_getc(uart, &c) != 0 || c == -1) {
+            break;
+        }
+        buf[i] = c;
+    }
+    return i;
+}
+
+int metal_uart_get_stats(struct metal_uart *uart,
+                         struct metal_uart_stats *stats) {
+    if (uart->vtable->get_stats == NULL) {
+        return -1;
+    }
+    return uart->vtable->get_stats(uart, stats);
+}